@@ -0,0 +1,68 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use FileHandle;
+use IPC::Open2;
+use Time::HiRes qw(time);
+
+#######################################################################
+# fgbench.pl - Foreground command latency benchmark
+#
+# Runs the shell as a child and feeds it <n> foreground commands, one
+# at a time.  Each command is followed by a bare "fg" builtin, whose
+# error message is printed synchronously by the shell; the time from
+# writing the command until that message arrives is the latency of
+# one foreground command as seen from outside the shell.
+#
+######################################################################
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] -s <shellprog> [-n <count>] [-c <cmd>]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    printf STDERR "  -s <shell>    Shell program to benchmark\n";
+    printf STDERR "  -n <count>    Number of commands (default 200)\n";
+    printf STDERR "  -c <cmd>      Command to run (default \"./myspin 0\")\n";
+    die "\n" ;
+}
+
+getopts('hs:n:c:');
+if ($opt_h) {
+    usage();
+}
+if (!$opt_s) {
+    usage("Missing required -s argument");
+}
+$shellprog = $opt_s;
+$count = $opt_n ? $opt_n : 200;
+$cmd = $opt_c ? $opt_c : "./myspin 0";
+
+-x $shellprog
+    or die "$0: ERROR: $shellprog not executable\n";
+
+$pid = open2(\*Reader, \*Writer, "$shellprog -p");
+Writer->autoflush();
+
+@lat = ();
+for ($i = 0; $i < $count; $i++) {
+    $start = time;
+    print Writer "$cmd\nfg\n";
+    while (($line = <Reader>) && $line !~ /^fg command requires/) {
+    }
+    defined($line)
+	or die "$0: ERROR: shell exited early\n";
+    push(@lat, (time - $start) * 1e6);
+}
+close(Writer);
+waitpid($pid, 0);
+
+@lat = sort { $a <=> $b } @lat;
+$sum = 0;
+foreach $l (@lat) {
+    $sum += $l;
+}
+printf("%s: %d x \"%s\"\n", $shellprog, $count, $cmd);
+printf("  mean %.1f us  p50 %.1f us  p99 %.1f us  max %.1f us\n",
+    $sum / $count, $lat[int($count * 0.50)], $lat[int($count * 0.99)],
+    $lat[$count - 1]);
@@ -0,0 +1,242 @@
+/*
+ * mkphash - Generates the perfect hash tables that tsh looks names up in
+ *
+ * usage: mkphash builtins | signals
+ *
+ * Writes a header to standard output for the names in the given list.
+ * For the list "builtins" it defines BUILTINS_COUNT, BUILTINS_SEED and
+ * BUILTINS_SLOTS, and an array builtins_slot that maps
+ * phash(name, BUILTINS_SEED) & (BUILTINS_SLOTS - 1) to one more than the
+ * index of the name in builtins.def, or to 0 if no name hashes there.  A
+ * lookup therefore hashes the name and compares it with at most one
+ * entry, however long the list is.
+ *
+ * For the list "signals" it also writes the names themselves: each
+ * signal name in signames.def and each RTMIN+n and RTMAX-n name, with
+ * its number, in the array signals, which SIGNALS_* and signals_slot
+ * index, and the preferred name of every signal number in the array
+ * signals_name.  The real-time signal numbers are those of the system
+ * mkphash runs on, which SIGNALS_RTMIN and SIGNALS_RTMAX record.
+ */
+
+#include <ctype.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "phash.h"
+
+#define MAXTRIES 100000 /* seeds to try before doubling the table */
+#define MAXNAME 24      /* longest signal name, including the NUL */
+
+#ifndef SIGRTMIN
+#define SIGRTMIN 0
+#undef SIGRTMAX
+#endif
+#ifndef SIGRTMAX
+#define SIGRTMAX (SIGRTMIN - 1)
+#endif
+
+struct numname {            /* A signal name and its number */
+	int num;                /* the signal number */
+	const char *name;       /* the name without "SIG" */
+};
+
+static const char *builtins[] = {
+#define BUILTIN(name, handler, flags) #name,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+static const struct numname numnames[] = {
+#define NUMNAME(name) { SIG##name, #name },
+#include "signames.def"
+#undef NUMNAME
+	/* Korn shell and Bash, of uncertain vintage. */
+	{ 0, "EXIT" }
+};
+
+static void gensignals(void);
+static void genhash(const char *list, const char **names, size_t n);
+static bool tryseed(const char **names, size_t n, uint32_t seed,
+    unsigned short *slot, size_t nslots);
+
+int
+main(int argc, char **argv)
+{
+
+	if (argc != 2 || (strcmp(argv[1], "builtins") != 0 &&
+	    strcmp(argv[1], "signals") != 0)) {
+		fprintf(stderr, "usage: mkphash builtins | signals\n");
+		exit(1);
+	}
+	printf("/* Generated by mkphash from the %s list; do not edit. */\n\n",
+	    argv[1]);
+	if (strcmp(argv[1], "builtins") == 0)
+		genhash(argv[1], builtins,
+		    sizeof(builtins) / sizeof(builtins[0]));
+	else
+		gensignals();
+	exit(0);
+}
+
+/*
+ * gensignals
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Prints the signal name tables and their perfect hash.
+ */
+static void
+gensignals(void)
+{
+	size_t nnumnames = sizeof(numnames) / sizeof(numnames[0]);
+	int rtmin = SIGRTMIN, rtmax = SIGRTMAX;
+	int i, delta, maxnum = 0;
+	size_t j, n = 0;
+	char (*names)[MAXNAME];
+	const char **keys;
+	int *nums;
+
+	if (rtmin > 0 && rtmax < rtmin)
+		rtmax = rtmin - 1;
+	n = nnumnames + (rtmin > 0 ? 2 * (rtmax - rtmin + 1) : 0);
+	if ((names = malloc(n * sizeof(*names))) == NULL ||
+	    (keys = malloc(n * sizeof(*keys))) == NULL ||
+	    (nums = malloc(n * sizeof(*nums))) == NULL) {
+		perror("mkphash");
+		exit(1);
+	}
+
+	/* The fixed names, then both names of each real-time signal. */
+	n = 0;
+	for (j = 0; j < nnumnames; j++) {
+		snprintf(names[n], MAXNAME, "%s", numnames[j].name);
+		nums[n++] = numnames[j].num;
+	}
+	for (delta = 0; rtmin > 0 && delta <= rtmax - rtmin; delta++) {
+		snprintf(names[n], MAXNAME, delta > 0 ? "RTMIN+%d" : "RTMIN",
+		    delta);
+		nums[n++] = rtmin + delta;
+		snprintf(names[n], MAXNAME, delta > 0 ? "RTMAX-%d" : "RTMAX",
+		    delta);
+		nums[n++] = rtmax - delta;
+	}
+	for (j = 0; j < n; j++) {
+		keys[j] = names[j];
+		if (nums[j] > maxnum)
+			maxnum = nums[j];
+	}
+
+	printf("#define SIGNALS_RTMIN %d\n", rtmin);
+	printf("#define SIGNALS_RTMAX %d\n\n", rtmax);
+	printf("static const struct { char name[SIG2STR_MAX]; int num; } "
+	    "signals[] = {\n");
+	for (j = 0; j < n; j++)
+		printf("\t{ \"%s\", %d },\n", names[j], nums[j]);
+	printf("};\n\n");
+
+	/* A real-time signal's preferred name is the one sig2str has
+	 * always printed: RTMIN+n in the lower half and RTMAX-n above.
+	 */
+	printf("#define SIGNALS_BOUND %d\n\n", maxnum + 1);
+	printf("static const char signals_name[SIGNALS_BOUND][SIG2STR_MAX] = "
+	    "{\n");
+	for (i = 0; i <= maxnum; i++) {
+		for (j = 0; j < n; j++) {
+			if (nums[j] != i)
+				continue;
+			if (i < rtmin || i > rtmax || (i <= rtmin +
+			    (rtmax - rtmin) / 2 ? strncmp(names[j], "RTMIN", 5) :
+			    strncmp(names[j], "RTMAX", 5)) == 0)
+				break;
+		}
+		printf("\t\"%s\",\n", j < n ? names[j] : "");
+	}
+	printf("};\n\n");
+
+	genhash("signals", keys, n);
+	free(names);
+	free(keys);
+	free(nums);
+}
+
+/*
+ * genhash
+ *
+ * Requires:
+ *  "names" is an array of "n" distinct strings.
+ *
+ * Effects:
+ *  Finds the smallest power-of-two table, and a seed for it, in which no
+ *  two of "names" share a slot, and prints the header for "list".
+ */
+static void
+genhash(const char *list, const char **names, size_t n)
+{
+	unsigned short *slot;
+	char upper[64];
+	size_t i, nslots;
+	uint32_t seed;
+
+	for (i = 0; list[i] != '\0' && i < sizeof(upper) - 1; i++)
+		upper[i] = toupper((unsigned char)list[i]);
+	upper[i] = '\0';
+
+	for (nslots = 1; nslots < n; nslots *= 2)
+		;
+	if ((slot = malloc(nslots * sizeof(*slot))) == NULL) {
+		perror("mkphash");
+		exit(1);
+	}
+	for (seed = 1; !tryseed(names, n, seed, slot, nslots); seed++) {
+		if (seed % MAXTRIES == 0) {
+			nslots *= 2;
+			if ((slot = realloc(slot, nslots * sizeof(*slot))) ==
+			    NULL) {
+				perror("mkphash");
+				exit(1);
+			}
+		}
+	}
+
+	printf("#define %s_COUNT %zu\n", upper, n);
+	printf("#define %s_SEED %#xU\n", upper, seed);
+	printf("#define %s_SLOTS %zu\n\n", upper, nslots);
+	printf("static const unsigned short %s_slot[%s_SLOTS] = {", list,
+	    upper);
+	for (i = 0; i < nslots; i++)
+		printf("%s%u,", i % 16 == 0 ? "\n\t" : " ", slot[i]);
+	printf("\n};\n");
+	free(slot);
+}
+
+/*
+ * tryseed
+ *
+ * Requires:
+ *  "slot" has room for "nslots" entries, a power of two.
+ *
+ * Effects:
+ *  Fills "slot" for "names" hashed with "seed" and returns true if no two
+ *  names collide.  Returns false otherwise.
+ */
+static bool
+tryseed(const char **names, size_t n, uint32_t seed, unsigned short *slot,
+    size_t nslots)
+{
+	size_t i, j;
+
+	memset(slot, 0, nslots * sizeof(*slot));
+	for (i = 0; i < n; i++) {
+		j = phash(names[i], seed) & (nslots - 1);
+		if (slot[j] != 0)
+			return (false);
+		slot[j] = i + 1;
+	}
+	return (true);
+}
@@ -0,0 +1,29 @@
+/*
+ * phash.h - The string hash used by the shell's perfect hash tables
+ *
+ * mkphash searches for a seed that makes phash map each name in a list
+ * to its own slot, and the lookup routines in the shell use the same
+ * function with that seed, so the two must agree exactly.
+ */
+
+#include <stdint.h>
+
+/*
+ * phash
+ *
+ * Requires:
+ *  "key" is a NUL-terminated string.
+ *
+ * Effects:
+ *  Returns an FNV-1a hash of "key" started from "seed", with the high
+ *  bits folded into the low bits that the tables are indexed by.
+ */
+static inline uint32_t
+phash(const char *key, uint32_t seed)
+{
+	uint32_t h = 2166136261U ^ seed;
+
+	for (; *key != '\0'; key++)
+		h = (h ^ (unsigned char)*key) * 16777619U;
+	return (h ^ (h >> 15) ^ (h >> 23));
+}
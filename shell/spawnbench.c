@@ -0,0 +1,202 @@
+/*
+ * spawnbench - Compares the cost of the shell's launch engines
+ *
+ * usage: spawnbench [n]
+ *
+ * Grows the heap to several sizes and, at each size, launches /bin/true
+ * <n> times (default 200) with fork+execv and with posix_spawn, set up
+ * the way tsh sets them up, reporting the mean latency of a launch and
+ * reap.  Every page of the heap is written before the launches and read
+ * back after them, so the pages are really mapped while the shell forks.
+ */
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static char *true_argv[] = { "/bin/true", NULL };
+static posix_spawnattr_t attr;  /* attributes as tsh prepares them */
+
+static void launch_fork(void);
+static void launch_spawn(void);
+static double bench(void (*fn)(void), int n);
+static void touch(volatile char *heap, size_t size);
+static size_t checksum(volatile const char *heap, size_t size);
+static double now(void);
+
+int
+main(int argc, char **argv)
+{
+	static const size_t heap_mb[] = { 0, 16, 64, 256, 1024 };
+	sigset_t empty;
+	size_t i, size;
+	double forkus, spawnus;
+	char *heap;
+	int n;
+
+	n = argc > 1 ? atoi(argv[1]) : 200;
+	if (n <= 0) {
+		fprintf(stderr, "usage: spawnbench [n]\n");
+		exit(1);
+	}
+	sigemptyset(&empty);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+	    POSIX_SPAWN_SETSIGMASK);
+	posix_spawnattr_setpgroup(&attr, 0);
+	posix_spawnattr_setsigmask(&attr, &empty);
+
+	printf("%8s %12s %12s\n", "heap", "fork us", "spawn us");
+	for (i = 0; i < sizeof(heap_mb) / sizeof(heap_mb[0]); i++) {
+		size = heap_mb[i] << 20;
+		if ((heap = malloc(size > 0 ? size : 1)) == NULL) {
+			printf("%6zuMB: malloc failed\n", heap_mb[i]);
+			break;
+		}
+		touch(heap, size);
+		forkus = bench(launch_fork, n);
+		spawnus = bench(launch_spawn, n);
+		if (checksum(heap, size) != size / 4096) {
+			fprintf(stderr, "spawnbench: heap was not kept\n");
+			exit(1);
+		}
+		printf("%6zuMB %12.1f %12.1f\n", heap_mb[i], forkus, spawnus);
+		fflush(stdout);
+		free(heap);
+	}
+	exit(0);
+}
+
+/*
+ * launch_fork - Launch and reap /bin/true with fork and execv.
+ *
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Forks a child that puts itself in its own process group and executes
+ *   /bin/true, then waits for it.
+ */
+static void
+launch_fork(void)
+{
+	pid_t pid;
+
+	if ((pid = fork()) == 0) {
+		setpgid(0, 0);
+		execv(true_argv[0], true_argv);
+		_exit(1);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+/*
+ * launch_spawn - Launch and reap /bin/true with posix_spawn.
+ *
+ * Requires:
+ *   "attr" has been initialized.
+ *
+ * Effects:
+ *   Spawns /bin/true with the attributes in "attr", then waits for it.
+ *   Exits if posix_spawn fails.
+ */
+static void
+launch_spawn(void)
+{
+	pid_t pid;
+
+	if (posix_spawn(&pid, true_argv[0], NULL, &attr, true_argv,
+	    environ) != 0) {
+		perror("posix_spawn");
+		exit(1);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+/*
+ * bench - Time a launch routine.
+ *
+ * Requires:
+ *   "n" is positive.
+ *
+ * Effects:
+ *   Calls "fn" "n" times and returns the mean time of a call, in
+ *   microseconds.
+ */
+static double
+bench(void (*fn)(void), int n)
+{
+	double start;
+	int i;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		fn();
+	return ((now() - start) / n);
+}
+
+/*
+ * touch - Map every page of a heap block.
+ *
+ * Requires:
+ *   "heap" points to at least "size" bytes.
+ *
+ * Effects:
+ *   Writes zero to the whole block and 1 to the first byte of each 4096
+ *   byte page.  The writes go through a volatile pointer, so the compiler
+ *   cannot drop them even though the block is freed without being used.
+ */
+static void
+touch(volatile char *heap, size_t size)
+{
+	size_t i;
+
+	memset((char *)heap, 0, size);
+	for (i = 0; i < size; i += 4096)
+		heap[i] = 1;
+}
+
+/*
+ * checksum - Read back the pages written by touch.
+ *
+ * Requires:
+ *   "heap" points to at least "size" bytes that touch has written.
+ *
+ * Effects:
+ *   Returns the sum of the first byte of each 4096 byte page, which is
+ *   size / 4096 if the pages were kept.
+ */
+static size_t
+checksum(volatile const char *heap, size_t size)
+{
+	size_t i, sum = 0;
+
+	for (i = 0; i < size; i += 4096)
+		sum += heap[i];
+	return (sum);
+}
+
+/*
+ * now - Read the monotonic clock.
+ *
+ * Requires:
+ *   Nothing.
+ *
+ * Effects:
+ *   Returns the time of CLOCK_MONOTONIC in microseconds.
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e6 + ts.tv_nsec / 1e3);
+}
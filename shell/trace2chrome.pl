@@ -0,0 +1,108 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+#######################################################################
+# trace2chrome.pl - Convert a tsh -T trace to the Chrome trace format
+#
+# Reads the trace file that "tsh -T <file>" wrote and prints it as JSON
+# that chrome://tracing and Perfetto can open.  Parsing and waiting for
+# a foreground job are shown as spans of the shell, each child as a
+# span from fork to reap, and the other events as instants on the
+# shell's or the child's track.
+#
+######################################################################
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] <tracefile>\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    die "\n" ;
+}
+
+getopts('h');
+if ($opt_h) {
+    usage();
+}
+if (@ARGV != 1) {
+    usage("Missing trace file argument");
+}
+
+open(TRACE, "<", $ARGV[0])
+    or die "$0: ERROR: cannot open $ARGV[0]: $!\n";
+binmode(TRACE);
+
+# The header names the event types.
+$line = <TRACE>;
+$line eq "tsh-trace 1\n"
+    or die "$0: ERROR: $ARGV[0] is not a tsh trace\n";
+%names = ();
+while (($line = <TRACE>) && $line ne "\n") {
+    $line =~ /^(\d+) (.*)$/
+	or die "$0: ERROR: bad header line \"$line\"\n";
+    $names{$1} = $2;
+}
+
+# Each event is a 64-bit time in nanoseconds and four 32-bit fields.
+@states = ("undefined", "foreground", "background", "stopped", "queued");
+%jids = ();
+@out = ();
+while (read(TRACE, $rec, 24) == 24) {
+    ($ns, $type, $pid, $jid, $arg) = unpack("q l l l l", $rec);
+    $name = $names{$type};
+    $ts = sprintf("%.3f", $ns / 1000);
+    $jids{$pid} = $jid if ($jid != 0);
+    $tid = $pid;
+    %args = ();
+
+    if ($name eq "parse begin" || $name eq "wait begin") {
+	$ph = "B";
+	$tid = 0;
+	$name =~ s/ begin$//;
+	$args{"pid"} = $pid if ($pid != 0);
+	$args{"bytes"} = $arg if ($name eq "parse");
+    } elsif ($name eq "parse end" || $name eq "wait end") {
+	$ph = "E";
+	$tid = 0;
+	$name =~ s/ end$//;
+    } elsif ($name eq "fork") {
+	$ph = "B";
+	$name = "child";
+    } elsif ($name eq "reap") {
+	# A stopped child is reaped again later; only exits end its span.
+	if (($arg & 0xff) == 0x7f) {
+	    $ph = "i";
+	    $name = "stopped";
+	} else {
+	    $ph = "E";
+	    $name = "child";
+	}
+	$args{"status"} = $arg;
+    } else {
+	$ph = "i";
+	$tid = 0 if ($name eq "signal" || $pid == 0);
+	$args{"signal"} = $arg if ($name eq "signal");
+	$args{"from"} = $pid if ($name eq "signal");
+	$args{"errno"} = $arg if ($name eq "exec fail");
+	$args{"state"} = $states[$arg] if ($name eq "state");
+    }
+    $args{"jid"} = $jids{$pid} if ($tid != 0 && $jids{$pid});
+
+    $argstr = join(",", map { "\"$_\":\"$args{$_}\"" } sort keys %args);
+    push(@out, sprintf("{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%s,"
+	. "\"pid\":1,\"tid\":%d%s,\"args\":{%s}}", $name, $ph, $ts, $tid,
+	$ph eq "i" ? ",\"s\":\"t\"" : "", $argstr));
+}
+close(TRACE);
+
+# Name the tracks: the shell, and each child by its job.
+push(@out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+    . "\"args\":{\"name\":\"tsh\"}}");
+foreach $pid (sort { $a <=> $b } keys %jids) {
+    next if ($pid == 0);
+    push(@out, sprintf("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+	. "\"tid\":%d,\"args\":{\"name\":\"[%d] (%d)\"}}", $pid,
+	$jids{$pid}, $pid));
+}
+print "{\"traceEvents\":[\n" . join(",\n", @out) . "\n]}\n";
@@ -5,93 +5,485 @@
  * Leo Meister lpm2
  */
 
+#define _GNU_SOURCE     /* for memfd_create */
+
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/pidfd.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sched.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "builtins.h"
+#include "phash.h"
 #include "sig2str.h"
 
-/* Constants - You may assume these are large enough. */
-#define MAXLINE      1024   /* max line size */
-#define MAXARGS       128   /* max args on a command line */
-#define MAXJOBS        16   /* max jobs at any point in time */
-#define MAXJID   (1 << 16)  /* max job ID */
+/* Constants - Buffers start at these sizes and grow as needed. */
+#define MAXLINE      1024   /* initial input buffer size */
+#define ARENACHUNK   4096   /* minimum size of an arena chunk */
+#define JOBSLAB        64   /* job records allocated at a time */
+#define MAXJID   (1 << 16)  /* job IDs are less than MAXJID */
+#define DONEJOBS      64    /* completed jobs remembered, a power of two */
+#define TRACERING   8192    /* trace events buffered, a power of two */
+#define REAPRING     256    /* reaped children buffered, a power of two */
+#define MAXRUNS  10000000   /* most runs that bench times */
+
+#define DEFPATH "/bin:/usr/bin"  /* search path used when PATH is unset */
+
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1U << 2) /* Linux 6.9 and later */
+#endif
+
+/* Launch engines */
+#define FORK 0  /* fork and execv */
+#define SPAWN 1 /* posix_spawn, falling back to FORK */
+#define ZYGOTE 2 /* the launcher zygote, falling back to FORK */
+
+/* Builtin flags */
+#define BUILTIN_REAP 0x1 /* reap exited children before running */
+
+/* Trace events */
+#define EV_PARSE_BEGIN 0  /* eval starts parsing a command line */
+#define EV_PARSE_END   1  /* parseline has returned */
+#define EV_FORK        2  /* fork or posix_spawn has returned a child */
+#define EV_EXEC_OK     3  /* the child has executed its program */
+#define EV_EXEC_FAIL   4  /* the child could not execute; arg is errno */
+#define EV_SIGNAL      5  /* a signal was read from the signalfd */
+#define EV_REAP        6  /* a child was waited for; arg is its status */
+#define EV_STATE       7  /* a job changed state; arg is the new state */
+#define EV_WAIT_BEGIN  8  /* waitfg starts waiting for a job */
+#define EV_WAIT_END    9  /* waitfg has returned */
+#define EV_COUNT      10
+
+/* Record a trace event if the -T option was given. */
+#define TRACE(type, pid, jid, arg) do {				\
+	if (tracefd != -1)						\
+		traceevent((type), (pid), (jid), (arg));		\
+} while (0)
 
 /* Job states */
 #define UNDEF 0 /* undefined */
 #define FG 1    /* running in foreground */
 #define BG 2    /* running in background */
 #define ST 3    /* stopped */
+#define QU 4    /* queued until fewer than "maxrunning" jobs run */
 
 /* 
- * Jobs states: FG (foreground), BG (background), ST (stopped)
+ * Jobs states: FG (foreground), BG (background), ST (stopped),
+ * QU (queued)
  * Job state transitions and enabling actions:
  *     FG -> ST  : ctrl-z
  *     ST -> FG  : fg command
  *     ST -> BG  : bg command
  *     BG -> FG  : fg command
- * At most one job can be in the FG state.
+ *     QU -> BG  : a running job stops or terminates
+ * At most one job can be in the FG state.  Queued jobs have no process
+ * yet; they are always the newest jobs in the list.
  */
 
 struct Job {                /* The job struct */
 	pid_t pid;              /* job PID */
 	int jid;                /* job ID [1, 2, ...] */
-	int state;              /* UNDEF, BG, FG, or ST */
-	char cmdline[MAXLINE];  /* command line */
+	int state;              /* UNDEF, BG, FG, ST, or QU */
+	int out;                /* slot in "outq" for the job's output, or -1 */
+	struct Job *prev;       /* previous job in the jobs list */
+	struct Job *next;       /* next job in the list, or next free record */
+	const char *cmdline;    /* command line, interned by internline */
+	int64_t start;          /* CLOCK_MONOTONIC start time, in nanoseconds */
+	struct termios *tmodes; /* terminal modes saved when it stopped */
+	int pidfd;              /* pidfd of its process, or -1 */
+	bool timed;             /* whether to print its usage when it ends */
 };
 typedef struct Job *JobP;
-struct Job jobs[MAXJOBS];   /* The jobs list */
 
-int nextjid = 1;            /* next job ID to allocate */
+/* A job record fills at most one cache line. */
+_Static_assert(sizeof(struct Job) <= 64, "struct Job exceeds 64 bytes");
+
+struct JobUsage {           /* The resources used by a job's process */
+	struct timespec start;  /* CLOCK_MONOTONIC time the job started */
+	struct timespec end;    /* time it was reaped or sampled */
+	struct timeval utime;   /* user CPU time */
+	struct timeval stime;   /* system CPU time */
+	long maxrss;            /* maximum resident set size in kilobytes */
+	long minflt;            /* page faults serviced without I/O */
+	long majflt;            /* page faults that required I/O */
+	long nvcsw;             /* voluntary context switches */
+	long nivcsw;            /* involuntary context switches */
+};
+
+struct DoneJob {            /* A job that has terminated */
+	pid_t pid;              /* job PID */
+	int jid;                /* job ID it had */
+	int status;             /* status from wait4 */
+	const char *cmdline;    /* command line, interned by internline */
+	struct JobUsage usage;  /* resources it used */
+};
+
+struct CmdLine {            /* An interned command line */
+	struct CmdLine *next;   /* next command line in the same hash bucket */
+	unsigned long hash;     /* hashname of the text */
+	int refs;               /* number of jobs using the text */
+	unsigned int len;       /* length of the text */
+	char text[];            /* the command line */
+};
+typedef struct CmdLine *CmdLineP;
+
+struct JobList {            /* The jobs list */
+	JobP first;             /* oldest job */
+	JobP last;              /* newest job */
+	JobP fg;                /* foreground job, or NULL */
+	JobP queued;            /* oldest queued job, or NULL */
+	JobP free;              /* job records not in use */
+	JobP *pidindex;         /* open-addressed hash index by PID */
+	JobP *jidindex;         /* open-addressed hash index by job ID */
+	size_t indexsize;       /* slots in each index, a power of two */
+	size_t njobs;           /* number of jobs in the list */
+	size_t nstate[QU + 1];  /* number of jobs in each state */
+	uint64_t jidmap[MAXJID / 64];     /* bit set for each job ID in use */
+	uint64_t jidused[MAXJID / 4096];  /* bit set for each nonzero word */
+	uint64_t jidavail[MAXJID / 4096]; /* bit set for each non-full word */
+};
+typedef struct JobList *JobListP;
+struct JobList jobs;        /* The jobs list */
+
+struct ArenaChunk {         /* A block of memory in an arena */
+	struct ArenaChunk *prev; /* the chunk allocated before this one */
+	size_t size;            /* bytes in "data" */
+	size_t used;            /* bytes of "data" handed out */
+	char data[];            /* the memory handed out by arena_alloc */
+};
+
+struct Arena {              /* A bump allocator released in bulk */
+	struct ArenaChunk *top; /* the chunk being allocated from */
+	struct ArenaChunk *spare; /* a released chunk kept for reuse */
+};
+
+struct ArenaMark {          /* A point to which an arena can be released */
+	struct ArenaChunk *chunk; /* the arena's top chunk at the mark */
+	size_t used;            /* bytes of "chunk" in use at the mark */
+};
+
+struct Arena cmdarena;      /* holds each command's arguments during eval */
+CmdLineP *cmdtab = NULL;    /* hash buckets of interned command lines */
+size_t cmdtabsize = 0;      /* number of buckets, a power of two */
+size_t ncmdlines = 0;       /* number of interned command lines */
+
+struct PathEntry {          /* A cached search path lookup */
+	struct PathEntry *next; /* next entry in the same hash bucket */
+	char *path;             /* full path, or NULL if not found */
+	int hits;               /* number of times the entry was used */
+	char name[];            /* command name */
+};
+typedef struct PathEntry *PathEntryP;
+
+struct EnvVar {             /* An environment variable */
+	struct EnvVar *next;    /* next variable in the same hash bucket */
+	char *str;              /* "name=value", as it appears in "envp" */
+	size_t namelen;         /* length of the name */
+	size_t slot;            /* index of "str" in "envp" */
+	unsigned long hash;     /* hash of the name */
+};
+typedef struct EnvVar *EnvVarP;
+
+struct Fastcmd {            /* A utility the shell can run without exec */
+	const char *name;       /* name of the utility in /bin or /usr/bin */
+	bool (*usable)(char **argv); /* whether "run" handles these args */
+	int (*run)(char **argv);     /* runs the utility, returning status */
+	bool inshell;           /* whether a FG run needs no child process */
+};
+typedef const struct Fastcmd *FastcmdP;
+
+struct Builtin {            /* A command that the shell runs itself */
+	const char *name;       /* the command's name */
+	void (*handler)(char **argv); /* runs the command */
+	int flags;              /* BUILTIN_* flags */
+};
+typedef const struct Builtin *BuiltinP;
+
+struct Output {             /* The buffered output of a batch command */
+	int fd;                 /* memfd holding the output, or -1 */
+	bool done;              /* whether the command has finished */
+};
+
+struct Bench {              /* A bench command in progress */
+	const char *cmdline;    /* interned command line of its BG jobs */
+	double *samples;        /* latencies measured, in seconds */
+	size_t nsamples;        /* number of latencies measured */
+	size_t warmup;          /* runs left to discard before measuring */
+	size_t running;         /* number of its jobs that are running */
+	bool stop;              /* whether ctrl-c has interrupted it */
+};
+
+struct TraceEvent {         /* A timestamped event in the trace file */
+	int64_t ns;             /* CLOCK_MONOTONIC time in nanoseconds */
+	int32_t type;           /* EV_* event type */
+	int32_t pid;            /* the process concerned, or 0 */
+	int32_t jid;            /* the job concerned, or 0 */
+	int32_t arg;            /* a value that depends on the type */
+};
+
+struct TraceRing {          /* Trace events not yet written */
+	struct TraceEvent *events; /* circular buffer of TRACERING events */
+	size_t head;            /* sequence number of the oldest event */
+	size_t tail;            /* sequence number of the next event */
+};
+
+struct ZygoteRequest {      /* A launch request sent to the zygote */
+	sigset_t mask;          /* the child's signal mask */
+	bool fg;                /* whether the child takes the terminal */
+	uint32_t argc;          /* number of arguments after the path */
+	uint32_t envc;          /* number of environment strings after them */
+};
+
+struct ReapEvent {          /* A child that has been waited for */
+	pid_t pid;              /* its PID */
+	int status;             /* status from wait4 */
+	struct timespec time;   /* CLOCK_MONOTONIC time it was reaped */
+	struct rusage ru;       /* the resources that it used */
+};
+
+struct ReapRing {           /* Reaped children whose jobs are not updated */
+	struct ReapEvent events[REAPRING]; /* circular buffer of events */
+	size_t head;            /* sequence number of the oldest event */
+	size_t tail;            /* sequence number of the next event */
+};
+
+struct OutputQueue {        /* Batch output waiting to be printed in order */
+	struct Output *slots;   /* circular buffer of outputs */
+	size_t size;            /* number of slots, a power of two */
+	size_t head;            /* sequence number of the oldest output */
+	size_t tail;            /* sequence number of the next output */
+};
+
+char *pathenv = NULL;       /* PATH that the search path was built from */
+char **pathdirs = NULL;     /* directories on the search path */
+struct timespec *pathmtimes = NULL; /* last seen mtime of each directory */
+int npathdirs = 0;          /* number of directories on the search path */
+PathEntryP *pathtab = NULL; /* hash buckets of the search path cache */
+size_t pathtabsize = 0;     /* number of buckets, a power of two */
+size_t npathentries = 0;    /* number of entries in the cache */
+
 extern char **environ;      /* defined in libc */
+char **envp = NULL;         /* the environment, NULL-terminated */
+size_t nenv = 0;            /* number of variables in "envp" */
+size_t envcap = 0;          /* room in "envp", not counting the NULL */
+EnvVarP *envtab = NULL;     /* hash buckets of the variables */
+size_t envtabsize = 0;      /* number of buckets, a power of two */
+char *envblock = NULL;      /* the strings of "envp", for the zygote */
+size_t envblocklen = 0;     /* length of "envblock" */
+bool envstale = true;       /* if true, "envblock" is out of date */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 bool verbose = false;       /* if true, print additional output */
 
+int engine = FORK;          /* how eval launches external commands */
+bool fastcmds = false;      /* if true, run some utilities without exec */
+size_t maxrunning = 0;      /* if nonzero, the most jobs to run at once */
+bool batch = false;         /* if true, run each command as a quiet BG job */
+bool keeporder = false;     /* if true, print batch output in input order */
+size_t nfailed = 0;         /* number of commands that failed */
+struct OutputQueue outq;    /* batch output not yet printed */
+struct DoneJob donejobs[DONEJOBS]; /* the last DONEJOBS completed jobs */
+struct Bench *bench = NULL; /* the bench command in progress, or NULL */
+struct TraceRing traceq;    /* trace events not yet written to "tracefd" */
+struct ReapRing reapq;      /* reaped children not yet drained */
+int tracefd = -1;           /* if not -1, the trace file given with -T */
+static const char *const eventnames[EV_COUNT] = { "parse begin",
+    "parse end", "fork", "exec ok", "exec fail", "signal", "reap", "state",
+    "wait begin", "wait end" };
+size_t ndone = 0;           /* number of jobs that have completed */
+int childfds[3] = { -1, -1, -1 }; /* if not -1, new children's fds 0-2 */
+bool childfg = false;       /* if true, new children take the terminal */
+bool pidfdgroups = true;    /* if false, groups are signalled with kill */
+bool slotwait = false;      /* if true, a FG command waits for a job slot */
+bool slotcancel = false;    /* if true, ctrl-c or ctrl-z cancelled it */
+posix_spawnattr_t spawnattr; /* attributes of jobs launched by SPAWN */
+int zygotefd = -1;          /* socket to the launcher zygote, or -1 */
+char *zygotebuf = NULL;     /* launch request being sent to the zygote */
+size_t zygotesize = 0;      /* size of "zygotebuf" */
+
+sigset_t shell_sigs;        /* signals delivered through "sigfd" */
+int sigfd = -1;             /* signalfd for the signals in "shell_sigs" */
+int ttyfd = -1;             /* controlling terminal, if job control is on */
+pid_t shellpgrp;            /* the shell's process group */
+struct termios shell_tmodes; /* the shell's terminal modes */
+int infd = STDIN_FILENO;    /* file that readcmd reads commands from */
+char *inbuf = NULL;         /* input bytes read by readcmd */
+size_t insize = 0;          /* size of "inbuf" */
+size_t inpos = 0;           /* offset in "inbuf" of the next line */
+size_t inlen = 0;           /* offset in "inbuf" of the end of the input */
+
 /* You will implement the following functions: */
 
-static void eval(const char *cmdline);
+static void eval(const char *cmdline, size_t len);
+static void runcmd(char **argv, bool bg_job, const char *cmdline, size_t len);
 static int builtin_cmd(char **argv);
 static void do_bgfg(char **argv);
 static void waitfg(pid_t pid);
+static void initterminal(void);
+static void giveterminal(JobP job);
+static void taketerminal(JobP job);
 static void initpath(const char *pathstr);
+static void do_hash(char **argv);
+static void do_quit(char **argv);
+static void do_jobs(char **argv);
+static void do_kill(char **argv);
+static void do_source(char **argv);
+static void do_bench(char **argv);
+static void do_export(char **argv);
+static void do_unset(char **argv);
+static void benchsample(struct Bench *b, double seconds);
+static void benchreport(struct Bench *b, const char *cmdline, size_t ninst,
+    double seconds);
+static int cmpdouble(const void *a, const void *b);
+static int parsesig(const char *spec);
+static void killjob(JobP job, int sig);
+static int signaljob(JobP job, int sig);
+static BuiltinP findbuiltin(const char *name);
 
 static void sigchld_handler(int signum);
+static void reapjob(JobP job);
+static struct ReapEvent *reapslot(void);
+static void pushreap(void);
+static void drainreaps(void);
+static void reapchild(const struct ReapEvent *ev);
 static void sigint_handler(int signum);
 static void sigtstp_handler(int signum);
 
 /* We've provided the following functions to you: */
 
-static int parseline(const char *cmdline, char **argv); 
+static int parseline(const char *cmdline, size_t len, struct Arena *arena,
+    char ***argvp); 
+static unsigned int splitblock(char *buf, bool *quoted);
 
 static void sigquit_handler(int signum);
+static void dispatch_signals(bool block);
+static bool pollsignals(int fd);
 
 static void clearjob(JobP job);
-static void initjobs(JobP jobs);
-static int maxjid(JobP jobs); 
-static int addjob(JobP jobs, pid_t pid, int state, const char *cmdline);
-static int deletejob(JobP jobs, pid_t pid); 
-static pid_t fgpid(JobP jobs);
-static JobP getjobpid(JobP jobs, pid_t pid);
-static JobP getjobjid(JobP jobs, int jid); 
+static void initjobs(JobListP jobs);
+static int maxjid(JobListP jobs); 
+static int allocjid(JobListP jobs);
+static void setjid(JobListP jobs, int jid, bool used);
+static JobP addjob(JobListP jobs, pid_t pid, int state,
+    const char *cmdline, size_t len);
+static int deletejob(JobListP jobs, pid_t pid); 
+static void removejob(JobListP jobs, JobP job);
+static void setjobstate(JobListP jobs, JobP job, int state);
+static pid_t fgpid(JobListP jobs);
+static JobP getjobpid(JobListP jobs, pid_t pid);
+static JobP getjobjid(JobListP jobs, int jid); 
 static int pid2jid(pid_t pid); 
-static void listjobs(JobP jobs);
+static void listjobs(JobListP jobs, bool details);
+static void printjob(JobP job, bool details);
+static struct DoneJob *recordjob(JobP job, const struct ReapEvent *ev);
+static void listdone(bool details, char **specs);
+static bool sampleusage(JobP job, struct JobUsage *usage);
+static void printusage(const struct JobUsage *usage);
+static void printtimes(const struct JobUsage *usage);
+static struct JobUsage *endusage(struct JobUsage *usage,
+    const struct rusage *before);
+static bool jobmatches(char **specs, pid_t pid, int jid);
+
+static const char *internline(const char *cmdline, size_t len);
+static const char *holdline(const char *cmdline);
+static void releaseline(const char *cmdline);
+static JobP *jobslot(JobP *index, size_t size, int key, bool bypid);
+static void indexjob(JobP *index, size_t size, JobP job, bool bypid);
+static void unindexjob(JobP *index, size_t size, JobP job, bool bypid);
+
+static void initlaunch(void);
+static pid_t launch(const char *path, char **argv);
+static pid_t launch_fork(const char *path, char **argv, FastcmdP fast);
+static pid_t launch_spawn(const char *path, char **argv);
+static void startzygote(void);
+static void zygote(int sock);
+static pid_t launch_zygote(const char *path, char **argv);
+static bool mustqueue(void);
+static bool startjob(JobP job, const char *path, char **argv, int state);
+static void startqueued(void);
+
+static size_t newoutput(void);
+static void endoutput(size_t seq);
+static void flushoutput(void);
+static void notfound(const char *name, int out);
+
+static FastcmdP getfastcmd(const char *path, char **argv);
+static bool fast_noopts(char **argv);
+static bool fast_echo_usable(char **argv);
+static int fast_echo(char **argv);
+static int hexvalue(int c);
+static int fast_true(char **argv);
+static int fast_false(char **argv);
+static bool fast_printf_usable(char **argv);
+static int fast_printf(char **argv);
+static bool printf_args(char **argv, bool output);
+static int printf_format(const char *format, char **args, bool output,
+    bool *stopp);
+static bool fast_sleep_usable(char **argv);
+static int fast_sleep(char **argv);
+static bool sleep_seconds(char **argv, double *secondsp);
 
+static unsigned long hashname(const char *name);
+static unsigned long hashbytes(const char *buf, size_t len);
+static bool statpath(void);
+static void checkpath(void);
+static PathEntryP getpathentry(const char *name, bool create);
+static void deletepathentry(const char *name);
+static void clearpathcache(void);
+static const char *findcmd(const char *name);
+
+static void initenv(void);
+static EnvVarP getenvvar(const char *name, size_t len);
+static bool setenvvar(const char *str, size_t namelen);
+static bool unsetenvvar(const char *name);
+static void growenv(void);
+static void envchanged(const char *name, size_t len);
+static const char *getenvblock(size_t *lenp);
+static bool validname(const char *name, size_t len);
+
+static void traceopen(const char *file);
+static void traceevent(int type, pid_t pid, int jid, int arg);
+static void traceflush(void);
+
+static char *readcmd(size_t *lenp);
+static bool runscript(const char *file);
+static void endinput(void);
+static char *signame(int signum, char *buf);
+static void *arena_alloc(struct Arena *arena, size_t size);
+static struct ArenaMark arena_mark(struct Arena *arena);
+static void arena_release(struct Arena *arena, struct ArenaMark mark);
 static void usage(void);
 static void unix_error(const char *msg);
 static void app_error(const char *msg);
 
-typedef void handler_t(int);
-static handler_t *Signal(int signum, handler_t *handler);
-
 /*
  * main - The shell's main routine 
  *
@@ -105,8 +497,11 @@ int
 main(int argc, char **argv) 
 {
 	int c;
-	char cmdline[MAXLINE];
+	int signum;
+	char *cmdline, *end;
+	size_t len;
 	char *path = NULL;
+	char *script = NULL;	/* a script file to run instead of stdin */
 	bool emit_prompt = true;	/* Emit a prompt by default. */
 
 	/*
@@ -116,7 +511,7 @@ main(int argc, char **argv)
 	dup2(1, 2);
 
 	/* Parse the command line. */
-	while ((c = getopt(argc, argv, "hvp")) != -1) {
+	while ((c = getopt(argc, argv, "hvpe:ij:f:kT:")) != -1) {
 		switch (c) {
 		case 'h':             /* Print a help message. */
 			usage();
@@ -128,47 +523,133 @@ main(int argc, char **argv)
 			/* This is handy for automatic testing. */
 			emit_prompt = false;
 			break;
+		case 'e':             /* Select the launch engine. */
+			if (strcmp(optarg, "fork") == 0)
+				engine = FORK;
+			else if (strcmp(optarg, "spawn") == 0)
+				engine = SPAWN;
+			else if (strcmp(optarg, "zygote") == 0)
+				engine = ZYGOTE;
+			else
+				usage();
+			break;
+		case 'i':             /* Run simple utilities in-process. */
+			fastcmds = true;
+			break;
+		case 'j':             /* Limit the number of running jobs. */
+			/* More jobs than there are job IDs cannot run. */
+			errno = 0;
+			maxrunning = strtoul(optarg, &end, 10);
+			if (!isdigit((unsigned char)optarg[0]) ||
+			    *end != '\0' || errno != 0 || maxrunning == 0 ||
+			    maxrunning >= MAXJID)
+				usage();
+			break;
+		case 'f':             /* Run a script in parallel. */
+			batch = true;
+			if (strcmp(optarg, "-") != 0)
+				script = optarg;
+			break;
+		case 'k':             /* Print batch output in order. */
+			keeporder = true;
+			break;
+		case 'T':             /* Trace each step of each job. */
+			traceopen(optarg);
+			break;
 		default:
 			usage();
 		}
 	}
+	if (optind < argc) {          /* Run a script file. */
+		if (script != NULL || optind + 1 < argc)
+			usage();
+		script = argv[optind];
+	}
+
+	/*
+	 * Block the signals the shell handles and receive them through a
+	 * signalfd instead, so that every handler runs synchronously from
+	 * the read/eval loop rather than interrupting it.
+	 */
+	sigemptyset(&shell_sigs);
+	sigaddset(&shell_sigs, SIGINT);   /* ctrl-c */
+	sigaddset(&shell_sigs, SIGTSTP);  /* ctrl-z */
+	sigaddset(&shell_sigs, SIGCHLD);  /* Terminated or stopped child */
+	sigaddset(&shell_sigs, SIGQUIT);  /* A clean way to kill the shell */
+	if (sigprocmask(SIG_BLOCK, &shell_sigs, NULL) == -1)
+		unix_error("sigprocmask error");
+
+	/*
+	 * An ignored signal is discarded rather than queued for the
+	 * signalfd, and children would inherit the ignored disposition, so
+	 * restore the default action of each one.  While they are blocked,
+	 * the default action never runs in the shell.
+	 */
+	for (signum = 1; signum < NSIG; signum++)
+		if (sigismember(&shell_sigs, signum) == 1)
+			signal(signum, SIG_DFL);
+	if ((sigfd = signalfd(-1, &shell_sigs, SFD_NONBLOCK | SFD_CLOEXEC)) ==
+	    -1)
+		unix_error("signalfd error");
 
-	/* Install the signal handlers. */
+	/*
+	 * Use the terminal for job control when the shell reads commands
+	 * from one.  Otherwise, as under the driver, ctrl-c and ctrl-z
+	 * reach the shell, which relays them to the foreground job.
+	 */
+	if (!batch && script == NULL && isatty(STDIN_FILENO))
+		initterminal();
 
-	/* These are the ones you will need to implement: */
-	Signal(SIGINT,  sigint_handler);   /* ctrl-c */
-	Signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
-	Signal(SIGCHLD, sigchld_handler);  /* Terminated or stopped child */
+	/* Initialize the launch engine. */
+	initlaunch();
 
-	/* This one provides a clean way to kill the shell. */
-	Signal(SIGQUIT, sigquit_handler); 
+	/*
+	 * In batch mode, run one job per processor by default, without a
+	 * prompt, and keep the children from reading the script.
+	 */
+	if (batch) {
+		emit_prompt = false;
+		if (maxrunning == 0 &&
+		    (maxrunning = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+			maxrunning = 1;
+		if ((childfds[0] = open("/dev/null", O_RDONLY | O_CLOEXEC)) ==
+		    -1)
+			unix_error("/dev/null");
+	} else
+		keeporder = false;
 
-	/* Initialize the search path. */
+	/* Initialize the environment and the search path. */
+	initenv();
 	path = getenv("PATH");
 	initpath(path);
 
 	/* Initialize the jobs list. */
-	initjobs(jobs);
+	initjobs(&jobs);
+	if (verbose)
+		printf("Job record: %zu bytes plus interned command line "
+		    "(was %zu bytes with an inline command line)\n",
+		    sizeof(struct Job), 3 * sizeof(int) + 1024);
+
+	/* Run a script file without the read/eval loop. */
+	if (script != NULL) {
+		if (!runscript(script))
+			exit(1);
+		endinput();
+	}
 
 	/* Execute the shell's read/eval loop. */
 	while (true) {
 
-		/* Read the command line. */
-		if (emit_prompt) {
+		/* Read the command line.  readcmd flushes the prompt and
+		 * any other output before it waits for input.
+		 */
+		if (emit_prompt)
 			printf("%s", prompt);
-			fflush(stdout);
-		}
-		if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-			app_error("fgets error");
-		if (feof(stdin)) { /* End of file (ctrl-d) */
-			fflush(stdout);
-			exit(0);
-		}
+		if ((cmdline = readcmd(&len)) == NULL) /* End of file */
+			endinput();
 
 		/* Evaluate the command line. */
-		eval(cmdline);
-		fflush(stdout);
-		fflush(stdout);
+		eval(cmdline, len);
 	}
 
 	exit(0); /* Control never reaches here. */
@@ -186,134 +667,224 @@ main(int argc, char **argv)
  * when we type ctrl-c (ctrl-z) at the keyboard.  
  *
  * Requires:
- *  A string representing a command for the shell to execute
+ *  A string representing a command for the shell to execute, and its
+ *  length
  *
  * Effects:
  *  Executes the given command, either as a built-in command or as an executable  	
- * file depending on the arguments
+ * file depending on the arguments.  The arguments live in "cmdarena"
+ * and are released when eval returns.
  */
 static void
-eval(const char *cmdline) 
+eval(const char *cmdline, size_t len) 
 {
-
+	struct ArenaMark mark = arena_mark(&cmdarena);
 	int bg_job;	/* whether the job is to run in the background */
-	int pid;	/* the process id returned from fork */
 	/* string array to store command line arguments */
-	char **argv = malloc(sizeof(char **));	
+	char **argv;
 	
-	bg_job = parseline(cmdline, argv);
+	TRACE(EV_PARSE_BEGIN, 0, 0, (int)len);
+	bg_job = parseline(cmdline, len, &cmdarena, &argv) || batch;
+	TRACE(EV_PARSE_END, 0, 0, (int)len);
+	runcmd(argv, bg_job, cmdline, len);
+	arena_release(&cmdarena, mark);
+}
+
+/*
+ * runcmd
+ *
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector, and "cmdline" holds the
+ *  "len" bytes of the command line, ending in a newline, that a job
+ *  started from it is listed with.
+ *
+ * Effects:
+ *  Runs "argv" as eval describes, in the background if "bg_job" is
+ *  true.  The entries of "argv" may be changed.
+ */
+static void
+runcmd(char **argv, bool bg_job, const char *cmdline, size_t len)
+{
+	JobP job;	/* the job running the command */
+	const char *path;	/* the executable that argv[0] names */
+	FastcmdP fast;	/* the shell's own version of the utility */
+	struct JobUsage usage;	/* what a command run by "time" used */
+	struct rusage before;	/* the shell's usage before that command */
+	bool timed = false;	/* whether the command is run by "time" */
+	size_t out;	/* output slot of a missing command, with -k */
+
+	/* The "time" keyword reports the usage of the command after it.
+	 * A command run as a job is reported when it is reaped, so the
+	 * report covers any stops and restarts by fg and bg; any other
+	 * command runs in the shell and is measured here.
+	 */
+	if (argv[0] != NULL && strcmp(argv[0], "time") == 0) {
+		timed = true;
+		argv++;
+		clock_gettime(CLOCK_MONOTONIC, &usage.start);
+		getrusage(RUSAGE_SELF, &before);
+	}
 	
 	/* If nothing is entered, don't evaluate */
 	if (argv[0] == NULL)
-		return;
+		;
 	/* Run the command if it is builtin, otherwise execute
 	 * the executable specified by the first argument
 	 */
 	else if (!builtin_cmd(argv)) {
-		
-		/* Block sigchld signals in the parent */
-		sigset_t mask;
-		sigemptyset(&mask);
-		sigaddset(&mask, SIGCHLD);
-		sigprocmask(SIG_BLOCK, &mask, NULL);
-					
-		/* fork a child process to run the job, setting its groupd id,
-		 * unblocking the sig_child signal, and using execvp to
-		 * search the search path if necessary
+
+		/* Resolve the command through the search path cache, so
+		 * that a missing command does not cost a fork.
 		 */
-		if ((pid = fork()) == 0) {
-			setpgid(0, 0);
-			if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1)
-				unix_error("Problem unblocking SIGCHLD!");			
-			if (execvp(argv[0], argv) == -1) {
-				printf("%s: Command not found\n", argv[0]);
-				exit(0);
-			}
+		if ((path = findcmd(argv[0])) == NULL) {
+			if (keeporder) {
+				out = newoutput();
+				notfound(argv[0], out);
+				endoutput(out);
+			} else
+				notfound(argv[0], -1);
+			nfailed++;
 		}
 
-		/* In the parent process (the child terminates after the
-		 * execvp call), add the job to the background or foreground
-		 * as appropriate and then unblocking the child signal.
+		/* A foreground utility that the shell implements itself
+		 * runs without a child process or a job.
 		 */
-		if (bg_job) {
-			if (!addjob(jobs, pid, BG, cmdline)) {
-				if (verbose)
-					printf("Error: Problem adding"
-					    " background job!\n");
-				exit(1);
+		else if (!bg_job && (fast = getfastcmd(path, argv)) != NULL &&
+		    fast->inshell)
+			fast->run(argv);
+
+		/* A background command beyond the -j limit is queued, and
+		 * a foreground command waits until every queued command
+		 * has started and a job slot is free, unless ctrl-c or
+		 * ctrl-z cancels it while it waits.  The job is added
+		 * before the child is started, so that running out of job
+		 * IDs cannot leave an untracked child.
+		 */
+		else if (bg_job) {
+			if ((job = addjob(&jobs, 0, UNDEF, cmdline, len)) ==
+			    NULL)
+				;
+			else {
+				job->timed = timed;
+				timed = false;
+				if (keeporder)
+					job->out = newoutput();
+				if (mustqueue()) {
+					setjobstate(&jobs, job, QU);
+					if (!batch)
+						printf("[%d] Queued %s",
+						    job->jid, job->cmdline);
+				} else if (startjob(job, path, argv, BG) &&
+				    !batch)
+					printf("[%d] (%d) %s", job->jid,
+					    job->pid, job->cmdline);
 			}
-			if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1)
-				unix_error("Problem unblocking SIGCHLD!");
-			printf("[%d] (%d) %s", getjobpid(jobs, pid)->jid, pid, 
-			    cmdline);
 		} // end if
 		else {
-			if (!addjob(jobs, pid, FG, cmdline)) {
-				if (verbose)
-					printf("Error: Problem adding"
-					    " foreground job!\n");
-				exit(1);
+			slotwait = mustqueue();
+			slotcancel = false;
+			while (mustqueue() && !slotcancel)
+				dispatch_signals(true);
+			slotwait = false;
+			if (slotcancel) {
+				printf("%s: cancelled while waiting for a job "
+				    "slot\n", argv[0]);
+				nfailed++;
+			} else if ((job = addjob(&jobs, 0, UNDEF, cmdline,
+			    len)) != NULL) {
+				job->timed = timed;
+				timed = false;
+				if (startjob(job, path, argv, FG))
+					waitfg(job->pid);
 			}
-			if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1)
-				unix_error("Problem unblocking SIGCHLD!");
-			waitfg(pid);
 		} // end else		
 	} // end else if not built in
 
-	return;
+	if (timed)
+		printtimes(endusage(&usage, &before));
 }
 
 /* 
  * parseline - Parse the command line and build the argv array.
  *
  * Requires:
- *  "cmdline" is a NUL ('\0') terminated string with a trailing
- *  '\n' character.  "cmdline" must contain less than MAXARGS
- *  arguments.
+ *  "cmdline" holds "len" bytes, normally ending with a '\n' character.
+ *  There is no limit on the length or number of arguments.
  *
  * Effects:
- *  Builds "argv" array from space delimited arguments on the command line.
- *  The final element of "argv" is set to NULL.  Characters enclosed in
- *  single quotes are treated as a single argument.  Returns true if
- *  the user has requested a BG job and false if the user has requested
- *  a FG job.
+ *  Builds an "argv" array from blank delimited arguments on the command
+ *  line in a single pass over a copy of the line, allocating the copy
+ *  and the array from "arena".  The final element of "argv" is set to
+ *  NULL.  Characters enclosed in single quotes are treated as a single
+ *  argument.  Returns true if the user has requested a BG job and false
+ *  if the user has requested a FG job.
  */
 static int
-parseline(const char *cmdline, char **argv) 
+parseline(const char *cmdline, size_t len, struct Arena *arena,
+    char ***argvp) 
 {
 	int argc;                   /* number of args */
 	int bg;                     /* background job? */
-	static char array[MAXLINE]; /* holds local copy of command line */
-	char *buf = array;          /* ptr that traverses command line */
-	char *delim;                /* points to first space delimiter */
+	char *buf;                  /* local copy of command line */
+	char **argv;                /* argument array */
+	char *delim;                /* closing quote of a quoted argument */
+	unsigned int blanks;        /* blank bytes in buf[i..i+15] */
+	unsigned int edges;         /* where arguments begin and end there */
+	unsigned int prevblank;     /* whether buf[i - 1] is blank */
+	bool quoted;                /* whether buf[i..i+15] has a quote */
+	size_t i, next, k;
 
-	strcpy(buf, cmdline);
-	buf[strlen(buf) - 1] = ' '; /* Replace trailing '\n' with space. */
-	while (*buf && (*buf == ' ')) /* Ignore leading spaces. */
-		buf++;
+	/*
+	 * A line of "len" bytes has at most (len + 1) / 2 arguments, so one
+	 * allocation holds the copy and the largest possible array.  The
+	 * copy is padded with 16 blanks so that it can be scanned 16 bytes
+	 * at a time.
+	 */
+	argv = arena_alloc(arena, ((len + 1) / 2 + 1) * sizeof(char *) +
+	    len + 16);
+	buf = (char *)&argv[(len + 1) / 2 + 1];
+	memcpy(buf, cmdline, len);
+	memset(&buf[len], ' ', 16);
 
-	/* Build the argv list */
+	/*
+	 * Build the argv list.  For each 16-byte block, the bit for a byte
+	 * is set in "edges" if the byte starts an argument (it is not blank
+	 * but the byte before it is) or ends one (it is blank but the byte
+	 * before it is not).  Unless the block has a quote, splitblock has
+	 * already replaced its blanks with NULs, and only the starts need
+	 * to be recorded.
+	 */
 	argc = 0;
-	if (*buf == '\'') {
-		buf++;
-		delim = strchr(buf, '\'');
-	} else
-		delim = strchr(buf, ' ');
-
-	while (delim) {
-		argv[argc++] = buf;
-		*delim = '\0';
-		buf = delim + 1;
-		while (*buf && (*buf == ' ')) /* Ignore spaces. */
-			buf++;
-
-		if (*buf == '\'') {
-			buf++;
-			delim = strchr(buf, '\'');
-		} else
-			delim = strchr(buf, ' ');
+	prevblank = 1;
+	for (i = 0; i < len; i = next) {
+		next = i + 16;
+		blanks = splitblock(&buf[i], &quoted);
+		edges = (blanks ^ ((blanks << 1) | prevblank)) & 0xffff;
+		prevblank = blanks >> 15;
+		if (!quoted) {
+			for (edges &= ~blanks; edges != 0; edges &= edges - 1)
+				argv[argc++] = &buf[i + __builtin_ctz(edges)];
+			continue;
+		}
+		for (; edges != 0; edges &= edges - 1) {
+			k = i + __builtin_ctz(edges);
+			if (blanks & (1U << (k - i)))
+				buf[k] = '\0';
+			else if (buf[k] == '\'' && (delim = memchr(&buf[k + 1],
+			    '\'', len - k - 1)) != NULL) {
+				/* Resume scanning after the closing quote. */
+				argv[argc++] = &buf[k + 1];
+				*delim = '\0';
+				next = delim + 1 - buf;
+				prevblank = 1;
+				break;
+			} else
+				argv[argc++] = &buf[k];
+		}
 	}
+	buf[len] = '\0';
 	argv[argc] = NULL;
+	*argvp = argv;
     
 	if (argc == 0)  /* Ignore blank line. */
 		return (1);
@@ -325,6 +896,63 @@ parseline(const char *cmdline, char **argv)
 	return (bg);
 }
 
+/*
+ * splitblock
+ *
+ * Requires:
+ *  "buf" holds at least 16 bytes.
+ *
+ * Effects:
+ *  Returns a mask with bit i set if buf[i] is a space, tab or newline,
+ *  for i from 0 to 15, and sets "*quoted" to whether any of the 16 bytes
+ *  is a single quote.  If none is, replaces the blanks with NULs.  Where
+ *  SSE2 is available, the 16 bytes are examined at once.
+ */
+static unsigned int
+splitblock(char *buf, bool *quoted)
+{
+#ifdef __SSE2__
+	__m128i chunk = _mm_loadu_si128((const __m128i *)buf);
+	__m128i blanks = _mm_or_si128(_mm_or_si128(
+	    _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+	    _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))),
+	    _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+
+	*quoted = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk,
+	    _mm_set1_epi8('\''))) != 0;
+	if (!*quoted)
+		_mm_storeu_si128((__m128i *)buf, _mm_andnot_si128(blanks,
+		    chunk));
+	return (_mm_movemask_epi8(blanks));
+#else
+	unsigned int mask = 0;
+	int i;
+
+	*quoted = memchr(buf, '\'', 16) != NULL;
+	for (i = 0; i < 16; i++) {
+		if (buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\n') {
+			mask |= 1U << i;
+			if (!*quoted)
+				buf[i] = '\0';
+		}
+	}
+	return (mask);
+#endif
+}
+
+/*
+ * The builtin commands, registered in builtins.def, in the order of the
+ * generated builtins_slot table.
+ */
+static const struct Builtin builtin_table[] = {
+#define BUILTIN(name, handler, flags) { #name, handler, flags },
+#include "builtins.def"
+#undef BUILTIN
+};
+
+_Static_assert(sizeof(builtin_table) / sizeof(builtin_table[0]) ==
+    BUILTINS_COUNT, "builtins.h is out of date");
+
 /* 
  * builtin_cmd - If the user has typed a built-in command then execute
  *    it immediately.  
@@ -335,38 +963,104 @@ parseline(const char *cmdline, char **argv)
  * Effects:
  *	Checks if command argument is built in
  *	Runs built in command arguments
- *	The bg <job> command restarts <job> by sending it a SIGCONT signal, 
- * 		then runs it in the background.
- *	The fg <job> command restarts <job> by sending it a SIGCONT signal, 
- *		then runs it in the foreground. 
- * 	The <job> argument can be either a PID or a JID.
+ *	Returns 1 if the command was a builtin and 0 otherwise.  A builtin
+ *	with the BUILTIN_REAP flag first reaps any children that have
+ *	changed state, so that it sees the current job list.
  */
 static int
 builtin_cmd(char **argv) 
-{	
-	/* Exit on quit */
-	if (strcmp(argv[0], "quit") == 0)
-		exit(0);
-	/* Executes bg command */
-	else if (strcmp(argv[0], "bg") == 0) {
-		do_bgfg(argv);
-		return(1);
-	}
-	/* Executes fg command */
-	else if (strcmp(argv[0], "fg") == 0) {
-		do_bgfg(argv);
-		return(1);
-	}
-	/* Prints a list of all jobs */
-	else if (strcmp(argv[0], "jobs") == 0) {
-		listjobs(jobs);
-		return (1);
+{
+	BuiltinP builtin = findbuiltin(argv[0]);
+
+	if (builtin == NULL)
+		return (0);
+	if (builtin->flags & BUILTIN_REAP)
+		dispatch_signals(false);
+	builtin->handler(argv);
+	return (1);
+}
+
+/*
+ * findbuiltin
+ *
+ * Requires:
+ *  "name" is a NUL-terminated string.
+ *
+ * Effects:
+ *  Returns the builtin named "name", or NULL if there is none.  The
+ *  perfect hash generated by mkphash leaves at most one candidate, so
+ *  the cost does not depend on the number of builtins.
+ */
+static BuiltinP
+findbuiltin(const char *name)
+{
+	BuiltinP builtin;
+	unsigned int i;
+
+	i = builtins_slot[phash(name, BUILTINS_SEED) & (BUILTINS_SLOTS - 1)];
+	if (i == 0)
+		return (NULL);
+	builtin = &builtin_table[i - 1];
+	return (strcmp(builtin->name, name) == 0 ? builtin : NULL);
+}
+
+/*
+ * do_quit - Execute the builtin quit command.
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Exits the shell.
+ */
+static void
+do_quit(char **argv)
+{
+
+	(void)argv;
+	exit(0);
+}
+
+/*
+ * do_jobs - Execute the builtin jobs command.
+ *
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Prints a list of all jobs.  With "-l", each job is followed by the
+ *  resources it has used so far.  With "-d", lists the last DONEJOBS
+ *  jobs that have completed, with their exit status and the resources
+ *  they used, instead.  Any further arguments, PIDs or %jobids, select
+ *  the jobs to list.
+ */
+static void
+do_jobs(char **argv)
+{
+	const char *opt;
+	bool details = false, done = false;
+	JobP job;
+
+	for (argv++; *argv != NULL && (*argv)[0] == '-'; argv++) {
+		for (opt = &(*argv)[1]; *opt == 'l' || *opt == 'd'; opt++) {
+			if (*opt == 'l')
+				details = true;
+			else
+				done = true;
+		}
+		if (*opt != '\0' || opt == &(*argv)[1]) {
+			printf("jobs: %s: invalid option\n", *argv);
+			return;
+		}
 	}
+	if (done)
+		listdone(details, argv);
+	else if (*argv == NULL)
+		listjobs(&jobs, details);
 	else {
-		if (verbose)
-			printf("Error: No built in command, %s, found!", 
-				argv[0]);
-		return(0);
+		for (job = jobs.first; job != NULL; job = job->next)
+			if (jobmatches(argv, job->pid, job->jid))
+				printjob(job, details);
 	}
 }
 
@@ -404,7 +1098,7 @@ do_bgfg(char **argv)
 	/* Gets the job of the corresponding process id */
 	if (argv[1][0] != '%') {
 		pid = atoi(argv[1]);
-		bgfgJob = getjobpid(jobs, pid);
+		bgfgJob = getjobpid(&jobs, pid);
 		if (isdigit(argv[1][0]))
 			pj_id_flag = 0;
 	}
@@ -414,7 +1108,7 @@ do_bgfg(char **argv)
 		const char ch = '%';
    		ret = strchr(argv[1], ch);
 		jid = atoi(ret+1);
-		bgfgJob = getjobjid(jobs, jid);
+		bgfgJob = getjobjid(&jobs, jid);
 		pj_id_flag = 1;
 	}
 
@@ -430,483 +1124,4147 @@ do_bgfg(char **argv)
 		return;
 	}
 
+	/* A queued job has no process to continue yet */
+	if (bgfgJob->state == QU) {
+		printf("[%d] Queued %s", bgfgJob->jid, bgfgJob->cmdline);
+		return;
+	}
+
 	/* Executes bg by continuing the job in the background */
 	if (strcmp(argv[0], "bg") == 0) {
-		bgfgJob->state = BG;
+		setjobstate(&jobs, bgfgJob, BG);
 		printf("[%d] (%d) %s", pid2jid(bgfgJob->pid), 
 		    bgfgJob->pid, bgfgJob->cmdline);
-		kill(-bgfgJob->pid, SIGCONT);
+		signaljob(bgfgJob, SIGCONT);
 	}
 	/* Executes fg by continuing the job in the foreground */
 	else {
-		bgfgJob->state = FG;
-		kill(-bgfgJob->pid, SIGCONT);
+		setjobstate(&jobs, bgfgJob, FG);
+		if (ttyfd != -1)
+			giveterminal(bgfgJob);
+		signaljob(bgfgJob, SIGCONT);
 		waitfg(bgfgJob->pid);
 	}
 }
 
-/* 
- * waitfg - Block until process pid is no longer the foreground process.
- * Requires: 
- * 	Process id
+/*
+ * do_kill - Execute the builtin kill command.
  *
- * Effects: 
- * 	sleeps until the foreground job is no longer active
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Sends a signal, SIGTERM unless "-SIG", "-s SIG" or "-n NUM" names
+ *  another, to each target: a PID, a job "%jid", a range of jobs
+ *  "%first-last", or every job in a state, "%running", "%stopped",
+ *  "%queued" or "%all".  Jobs, including those named by PID, are
+ *  signalled as process groups, all from one pass over the job list.
+ *  With "-l", lists the signal names instead.
  */
 static void
-waitfg(pid_t pid)
+do_kill(char **argv)
 {
+	struct JidRange {
+		int first, last;
+	} *ranges;
+	char *end, name[SIG2STR_MAX];
+	size_t i, nranges = 0;
+	int sig = SIGTERM, states = 0;
+	JobP job, next;
+	long first, last, value;
 
-	/* Sleep while the given process is still active in the foreground */
-	while (fgpid(jobs) == pid) {
-		if (verbose)
-			printf("Sleeping...\n");
-		sleep(1);
+	/* Parse the signal. */
+	if (argv[1] != NULL && strcmp(argv[1], "-l") == 0) {
+		for (sig = 1; sig <= SIGRTMAX; sig++)
+			if (sig2str(sig, name) == 0)
+				printf("%2d) SIG%s\n", sig, name);
+		return;
+	}
+	argv++;
+	if (*argv != NULL && (*argv)[0] == '-') {
+		if (strcmp(*argv, "-s") == 0 || strcmp(*argv, "-n") == 0)
+			argv++;
+		else
+			(*argv)++;
+		if (*argv == NULL || (sig = parsesig(*argv)) == -1) {
+			printf("kill: %s: invalid signal specification\n",
+			    *argv != NULL ? *argv : "");
+			return;
+		}
+		argv++;
+	}
+	if (*argv == NULL) {
+		printf("kill command requires PID or %%jobid argument\n");
+		return;
+	}
+
+	/* Sort the targets into states and job ID ranges, signalling
+	 * PIDs that are not jobs at once.
+	 */
+	for (i = 0; argv[i] != NULL; i++)
+		;
+	ranges = arena_alloc(&cmdarena, i * sizeof(*ranges));
+	for (; *argv != NULL; argv++) {
+		if (strcmp(*argv, "%all") == 0)
+			states |= 1 << FG | 1 << BG | 1 << ST | 1 << QU;
+		else if (strcmp(*argv, "%running") == 0)
+			states |= 1 << FG | 1 << BG;
+		else if (strcmp(*argv, "%stopped") == 0)
+			states |= 1 << ST;
+		else if (strcmp(*argv, "%queued") == 0)
+			states |= 1 << QU;
+		else if ((*argv)[0] == '%' &&
+		    isdigit((unsigned char)(*argv)[1])) {
+			errno = 0;
+			first = last = strtol(&(*argv)[1], &end, 10);
+			if (*end == '-' && isdigit((unsigned char)end[1]))
+				last = strtol(&end[1], &end, 10);
+			if (*end != '\0' || errno != 0 || first <= 0 ||
+			    first > last || last >= MAXJID)
+				printf("kill: %s: argument must be a PID or "
+				    "%%jobid\n", *argv);
+			else if (first == last && getjobjid(&jobs, first) ==
+			    NULL)
+				printf("%s: No such job\n", *argv);
+			else {
+				ranges[nranges].first = first;
+				ranges[nranges++].last = last;
+			}
+		} else if (isdigit((unsigned char)(*argv)[0])) {
+			value = strtol(*argv, &end, 10);
+			if (*end != '\0' || value <= 0 || value != (pid_t)value)
+				printf("kill: %s: argument must be a PID or "
+				    "%%jobid\n", *argv);
+			else if ((job = getjobpid(&jobs, value)) != NULL) {
+				ranges[nranges].first = job->jid;
+				ranges[nranges++].last = job->jid;
+			} else if (kill(value, sig) == -1)
+				printf("(%ld): No such process\n", value);
+		} else
+			printf("kill: %s: argument must be a PID or %%jobid\n",
+			    *argv);
+	}
+
+	/* Signal every selected job in one pass over the list. */
+	for (job = jobs.first; job != NULL && (states != 0 || nranges > 0);
+	    job = next) {
+		next = job->next;
+		for (i = 0; i < nranges; i++)
+			if (job->jid >= ranges[i].first &&
+			    job->jid <= ranges[i].last)
+				break;
+		if ((states & 1 << job->state) != 0 || i < nranges)
+			killjob(job, sig);
 	}
 }
 
-/* 
- * initpath - Perform all necessary initialization of the search path,
- *   which may be simply saving the path.
+/*
+ * do_source - Execute the builtin source command.
  *
  * Requires:
- *   pathstr is the valid path from the environment.
+ *  "argv" is a NULL-terminated argument vector.
  *
  * Effects:
- *   If verbose output is selected, prints the path, otherwise does nothing
- *   No preprocessing required because of the use of execvp
+ *  Evaluates each line of the script named by argv[1] in this shell.
  */
 static void
-initpath(const char *pathstr)
-{	
-	if (verbose) {
-		if (pathstr == NULL) 
-			printf("Warning: Path is NULL!\n");
-		else
-			printf("Path= %s\n", pathstr);		
-	} 	
-	
-	return;
+do_source(char **argv)
+{
+
+	if (argv[1] == NULL) {
+		printf("source command requires a file argument\n");
+		return;
+	}
+	runscript(argv[1]);
 }
 
 /*
- * The signal handlers follow.
- */
-
-/* 
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *  a child job terminates (becomes a zombie), or stops because it
- *  received a SIGSTOP or SIGTSTP signal.  The handler reaps all
- *  available zombie children, but doesn't wait for any other
- *  currently running children to terminate.  
+ * do_bench - Execute the builtin bench command.
  *
  * Requires:
- *  A signal number
+ *  "argv" is a NULL-terminated argument vector.
  *
  * Effects:
- *  Reaps terminated children, changes the state of stopped children in the job 
- *  list to ST, removes terminated children from the jobs list, prints messages 
- *  if children received TSTP or INT signals
+ *  Runs "bench [-n runs] [-w warmup] [-c concurrency] command args...":
+ *  runs the command "warmup" times (default 0) and then "runs" times
+ *  (default 100, at most MAXRUNS) through runcmd, as if it had been
+ *  typed with exactly these arguments, with
+ *  standard output sent to /dev/null.  With a concurrency of 1 (the
+ *  default), each run is a foreground command, and its latency is the
+ *  time eval takes.  Otherwise each run is a background job, up to
+ *  "concurrency" of them are kept running, and a job's latency is the
+ *  time from its launch to its reaping.  Then prints the latencies'
+ *  distribution and the throughput.  Ctrl-c stops launching runs.
  */
 static void
-sigchld_handler(int signum)
+do_bench(char **argv)
 {
-	assert(signum == SIGCHLD);
-	pid_t pid;	/* the process id of the foreground process */
-	int status;	/* the status of waitpid */
+	struct Bench b = { NULL, NULL, 0, 0, 0, false };
+	struct timespec start, end;
+	size_t i, len, nargs, runs = 100, warmup = 0, ninst = 1;
+	char *cmdline, *stop, **arg, **runargv;
+	struct ArenaMark mark;
+	double begin = 0, elapsed;
+	JobP last;
+	int devnull, savedout;
+	long value;
 
-	/* make sure the given signal is a SIGCHLD signal */
-	if (signum == SIGCHLD) {
-		
-		/* Handle reaping of all terminated child and handle
-		 * stopped children
-		 */
-		while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) > 0) {
-		
-			JobP fgJob = getjobpid(jobs, pid);	
-	
-			if (verbose)
-				printf("Handler handling child %d\n", (int)pid);
-			
-			/* If stopped, move the process to the background,
-			 * and print the process if it was stopped or
-			 * terminated due to a signal. Remove the
-			 * job from the list if it was terminated.
-			 */
-			if (WIFSTOPPED(status) && fgJob != NULL) {
-				
-				fgJob->state = ST;
-				printf("Job [%d] (%d) stopped by signal "
-				    "SIGTSTP\n", 
-				    pid2jid(fgJob->pid), fgJob->pid);
-				    
-			} else if (WIFSIGNALED(status) && fgJob != NULL) {
-				
-				printf("Job [%d] (%d) terminated by signal " 	
-				    "SIGINT\n", 
-				    pid2jid(fgJob->pid), fgJob->pid);
-				deletejob(jobs, pid);
-				
-			} else if (WIFEXITED(status) && fgJob != NULL)
-				deletejob(jobs, pid);
+	if (bench != NULL) {
+		printf("bench: already running\n");
+		return;
+	}
+	for (argv++; *argv != NULL && (*argv)[0] == '-'; argv += 2) {
+		errno = 0;
+		if (strchr("nwc", (*argv)[1]) == NULL || (*argv)[1] == '\0' ||
+		    (*argv)[2] != '\0' || argv[1] == NULL ||
+		    (value = strtol(argv[1], &stop, 10)) < 0 || *stop != '\0' ||
+		    errno != 0 || (value == 0 && (*argv)[1] != 'w')) {
+			printf("bench: usage: bench [-n runs] [-w warmup] "
+			    "[-c concurrency] command args...\n");
+			return;
 		}
+		if ((*argv)[1] == 'n')
+			runs = value;
+		else if ((*argv)[1] == 'w')
+			warmup = value;
+		else
+			ninst = value;
 	}
-
-	return;
+	if (*argv == NULL) {
+		printf("bench command requires a command argument\n");
+		return;
+	}
+	if (runs > MAXRUNS || warmup > MAXRUNS) {
+		printf("bench: at most %d runs\n", MAXRUNS);
+		return;
+	}
+
+	/* The arguments are run as they are.  Joined by blanks, they only
+	 * name the jobs of the runs and the report.
+	 */
+	for (len = 4, nargs = 0; argv[nargs] != NULL; nargs++)
+		len += strlen(argv[nargs]) + 1;
+	cmdline = arena_alloc(&cmdarena, len);
+	for (len = 0, arg = argv; *arg != NULL; arg++)
+		len += sprintf(&cmdline[len], "%s%s", arg == argv ? "" : " ",
+		    *arg);
+	if (ninst > 1)
+		len += sprintf(&cmdline[len], " &");
+	cmdline[len++] = '\n';
+	cmdline[len] = '\0';
+	runargv = arena_alloc(&cmdarena, (nargs + 1) * sizeof(*runargv));
+
+	if ((b.samples = malloc(runs * sizeof(double))) == NULL)
+		unix_error("do_bench: malloc error");
+	b.warmup = warmup;
+	if (ninst > 1)
+		b.cmdline = internline(cmdline, len);
+	bench = &b;
+
+	/* Discard the output of the runs. */
+	fflush(stdout);
+	if ((devnull = open("/dev/null", O_WRONLY | O_CLOEXEC)) == -1 ||
+	    (savedout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)) == -1 ||
+	    dup2(devnull, STDOUT_FILENO) == -1)
+		unix_error("do_bench: cannot redirect output");
+	close(devnull);
+
+	for (i = 0; i < warmup + runs && !b.stop; i++) {
+		while (b.running >= ninst)
+			dispatch_signals(true);
+		last = jobs.last;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (i == warmup)
+			begin = start.tv_sec + start.tv_nsec / 1e9;
+		mark = arena_mark(&cmdarena);
+		memcpy(runargv, argv, (nargs + 1) * sizeof(*runargv));
+		runcmd(runargv, ninst > 1 || batch, cmdline, len);
+		arena_release(&cmdarena, mark);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		/* A background run is measured when it is reaped. */
+		if (ninst > 1 && jobs.last != last && jobs.last != NULL &&
+		    jobs.last->cmdline == b.cmdline)
+			b.running++;
+		else
+			benchsample(&b, (end.tv_sec - start.tv_sec) +
+			    (end.tv_nsec - start.tv_nsec) / 1e9);
+	}
+	while (b.running > 0)
+		dispatch_signals(true);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = end.tv_sec + end.tv_nsec / 1e9 - begin;
+
+	fflush(stdout);
+	if (dup2(savedout, STDOUT_FILENO) == -1)
+		unix_error("do_bench: cannot restore output");
+	close(savedout);
+	bench = NULL;
+
+	cmdline[len - (ninst > 1 ? 3 : 1)] = '\0';
+	benchreport(&b, cmdline, ninst, elapsed);
+	if (b.cmdline != NULL)
+		releaseline(b.cmdline);
+	free(b.samples);
+}
+
+/*
+ * benchsample
+ *
+ * Requires:
+ *  "b" points to a bench command in progress.
+ *
+ * Effects:
+ *  Records a latency of "seconds" for one run, unless warmup runs
+ *  remain to be discarded.
+ */
+static void
+benchsample(struct Bench *b, double seconds)
+{
+
+	if (b->warmup > 0)
+		b->warmup--;
+	else
+		b->samples[b->nsamples++] = seconds;
+}
+
+/*
+ * benchreport
+ *
+ * Requires:
+ *  "b" points to a finished bench command whose runs of "cmdline",
+ *  with "ninst" in flight, took "seconds" after the warmup.
+ *
+ * Effects:
+ *  Prints the minimum, median, 90th and 99th percentile, maximum and
+ *  mean latency, the throughput, and a histogram of the latencies in
+ *  power-of-two buckets of microseconds.
+ */
+static void
+benchreport(struct Bench *b, const char *cmdline, size_t ninst,
+    double seconds)
+{
+	size_t i, count, most, n = b->nsamples;
+	double *lat = b->samples, sum = 0, bound;
+	int pass;
+
+	if (n == 0) {
+		printf("bench: no runs completed\n");
+		return;
+	}
+	qsort(lat, n, sizeof(double), cmpdouble);
+	for (i = 0; i < n; i++)
+		sum += lat[i];
+	printf("bench: %zu runs of \"%s\", concurrency %zu\n", n, cmdline,
+	    ninst);
+	printf("  min %.1fus  p50 %.1fus  p90 %.1fus  p99 %.1fus  max %.1fus  "
+	    "mean %.1fus\n", lat[0] * 1e6, lat[n / 2] * 1e6,
+	    lat[n * 90 / 100] * 1e6, lat[n * 99 / 100] * 1e6,
+	    lat[n - 1] * 1e6, sum / n * 1e6);
+	printf("  throughput %.1f runs/s\n", seconds > 0 ? n / seconds : 0.0);
+
+	/* The first pass finds the largest bucket, to which the bars of
+	 * the second are scaled.
+	 */
+	for (most = 0, pass = 0; pass < 2; pass++) {
+		for (i = 0, bound = 1e-6; i < n; bound *= 2) {
+			for (count = 0; i < n && lat[i] < bound; i++)
+				count++;
+			if (pass == 0 && count > most)
+				most = count;
+			else if (pass == 1 && i > 0)
+				printf("  < %10.0fus %8zu %.*s\n", bound * 1e6,
+				    count, (int)((count * 40 + most - 1) /
+				    most), "########################"
+				    "################");
+		}
+	}
+}
+
+/*
+ * cmpdouble
+ *
+ * Requires:
+ *  "a" and "b" point to doubles.
+ *
+ * Effects:
+ *  Compares two doubles for qsort.
+ */
+static int
+cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return ((x > y) - (x < y));
+}
+
+/*
+ * do_export - Execute the builtin export command.
+ *
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Sets each "name=value" argument in the environment of the commands
+ *  that the shell runs.  A bare name is accepted and ignored, since the
+ *  shell has no variables that are not exported.  Without arguments,
+ *  prints the environment.
+ */
+static void
+do_export(char **argv)
+{
+	const char *eq;
+	size_t i, len;
+
+	if (argv[1] == NULL) {
+		for (i = 0; i < nenv; i++)
+			printf("export %s\n", envp[i]);
+		return;
+	}
+	for (argv++; *argv != NULL; argv++) {
+		eq = strchr(*argv, '=');
+		len = eq != NULL ? (size_t)(eq - *argv) : strlen(*argv);
+		if (!validname(*argv, len))
+			printf("export: `%s': not a valid identifier\n",
+			    *argv);
+		else if (eq != NULL)
+			setenvvar(*argv, len);
+	}
+}
+
+/*
+ * do_unset - Execute the builtin unset command.
+ *
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Removes each named variable from the environment.  A name that is
+ *  not set is not an error.
+ */
+static void
+do_unset(char **argv)
+{
+
+	for (argv++; *argv != NULL; argv++) {
+		if (!validname(*argv, strlen(*argv)))
+			printf("unset: `%s': not a valid identifier\n",
+			    *argv);
+		else
+			unsetenvvar(*argv);
+	}
+}
+
+/*
+ * parsesig
+ *
+ * Requires:
+ *  "spec" is a NUL-terminated string.
+ *
+ * Effects:
+ *  Returns the number of the signal that "spec" names, with or without
+ *  a "SIG" prefix, or given as a number.  Returns -1 if "spec" names no
+ *  signal.
+ */
+static int
+parsesig(const char *spec)
+{
+	int sig;
+
+	if (strncmp(spec, "SIG", 3) == 0)
+		spec += 3;
+	if (*spec == '\0' || str2sig(spec, &sig) == -1)
+		return (-1);
+	return (sig);
+}
+
+/*
+ * killjob
+ *
+ * Requires:
+ *  "job" is a job in the jobs list.
+ *
+ * Effects:
+ *  Sends "sig" to the process group of "job".  Like bash, continues a
+ *  stopped job after SIGTERM or SIGHUP so that it can act on it, and
+ *  marks a stopped job that is sent SIGCONT as running in the
+ *  background.  A queued job has no process group; any signal but
+ *  those that stop or continue a job removes it from the queue.
+ */
+static void
+killjob(JobP job, int sig)
+{
+	char name[SIG2STR_MAX + 3];
+
+	if (job->state == QU) {
+		if (sig != 0 && sig != SIGCONT && sig != SIGSTOP &&
+		    sig != SIGTSTP && sig != SIGTTIN && sig != SIGTTOU) {
+			printf("Job [%d] dequeued by signal %s\n", job->jid,
+			    signame(sig, name));
+			removejob(&jobs, job);
+		}
+		return;
+	}
+	if (signaljob(job, sig) == -1) {
+		printf("(%d): No such process\n", (int)job->pid);
+		return;
+	}
+	if (job->state == ST && (sig == SIGTERM || sig == SIGHUP))
+		signaljob(job, SIGCONT);
+	else if (job->state == ST && sig == SIGCONT)
+		setjobstate(&jobs, job, BG);
+}
+
+/*
+ * signaljob
+ *
+ * Requires:
+ *  "job" has been started.
+ *
+ * Effects:
+ *  Sends "sig" to the process group of "job" and returns 0, or returns
+ *  -1 with errno set.  The signal goes through the job's pidfd, which
+ *  names its process even if the PID has been reused, unless the job
+ *  has none or the kernel cannot signal a pidfd's process group.  Once
+ *  the job's first process has exited, its pidfd gives ESRCH, and the
+ *  signal goes to the rest of the group with kill.  Fails with ESRCH
+ *  only if the whole group has exited.
+ */
+static int
+signaljob(JobP job, int sig)
+{
+
+	if (job->pidfd != -1 && pidfdgroups) {
+		if (pidfd_send_signal(job->pidfd, sig, NULL,
+		    PIDFD_SIGNAL_PROCESS_GROUP) == 0)
+			return (0);
+		if (errno == EINVAL || errno == ENOSYS)
+			pidfdgroups = false;
+		else if (errno != ESRCH)
+			return (-1);
+	}
+	return (kill(-job->pid, sig));
+}
+
+/* 
+ * waitfg - Block until process pid is no longer the foreground process.
+ * Requires: 
+ * 	Process id
+ *
+ * Effects: 
+ * 	Blocks on the signalfd and the job's pidfd, and handles each batch
+ * 	of signals as it arrives until the foreground job has stopped or
+ * 	terminated.  When the pidfd shows that the job has terminated, the
+ * 	job alone is reaped.  Keyboard input is not read while the job is
+ * 	in the foreground.
+ */
+static void
+waitfg(pid_t pid)
+{
+	JobP job;
+
+	/* Wait while the given process is still active in the foreground */
+	TRACE(EV_WAIT_BEGIN, pid, pid2jid(pid), 0);
+	while (fgpid(&jobs) == pid) {
+		if (verbose)
+			printf("Waiting for foreground job %d\n", (int)pid);
+		job = getjobpid(&jobs, pid);
+		if (job->pidfd == -1)
+			dispatch_signals(true);
+		else {
+			if (pollsignals(job->pidfd))
+				reapjob(job);
+			dispatch_signals(false);
+		}
+	}
+	TRACE(EV_WAIT_END, pid, 0, 0);
+	if (ttyfd != -1)
+		taketerminal(getjobpid(&jobs, pid));
+}
+
+/*
+ * initterminal
+ *
+ * Requires:
+ *  Standard input is a terminal, and the shell's signals are blocked.
+ *
+ * Effects:
+ *  Turns job control on: waits until the shell is in the foreground,
+ *  puts it in a process group of its own that owns the terminal, and
+ *  saves the terminal's modes.  From then on the kernel delivers ctrl-c
+ *  and ctrl-z to the foreground job's process group directly, and the
+ *  shell only hands the terminal over and takes it back.
+ */
+static void
+initterminal(void)
+{
+
+	while (tcgetpgrp(STDIN_FILENO) != (shellpgrp = getpgrp()))
+		kill(-shellpgrp, SIGTTIN);
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+	if ((getpid() != shellpgrp && setpgid(0, 0) == -1) ||
+	    (ttyfd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10)) == -1)
+		unix_error("initterminal error");
+	shellpgrp = getpid();
+	if (tcsetpgrp(ttyfd, shellpgrp) == -1 ||
+	    tcgetattr(ttyfd, &shell_tmodes) == -1)
+		unix_error("initterminal error");
+}
+
+/*
+ * giveterminal
+ *
+ * Requires:
+ *  Job control is on and "job" has been started.
+ *
+ * Effects:
+ *  Makes the job's process group the terminal's foreground process
+ *  group, restoring the terminal modes it had when it stopped.
+ */
+static void
+giveterminal(JobP job)
+{
+
+	tcsetpgrp(ttyfd, job->pid);
+	if (job->tmodes != NULL)
+		tcsetattr(ttyfd, TCSADRAIN, job->tmodes);
+}
+
+/*
+ * taketerminal
+ *
+ * Requires:
+ *  Job control is on.  "job" is the job that was in the foreground, or
+ *  NULL if it has terminated.
+ *
+ * Effects:
+ *  Makes the shell the terminal's foreground process group again and
+ *  restores the shell's terminal modes, first saving the modes that a
+ *  stopped job left so that fg can restore them.
+ */
+static void
+taketerminal(JobP job)
+{
+
+	if (job != NULL && job->state == ST) {
+		if (job->tmodes == NULL &&
+		    (job->tmodes = malloc(sizeof(struct termios))) == NULL)
+			unix_error("taketerminal: malloc error");
+		tcgetattr(ttyfd, job->tmodes);
+	}
+	tcsetpgrp(ttyfd, shellpgrp);
+	tcsetattr(ttyfd, TCSADRAIN, &shell_tmodes);
+}
+
+/* 
+ * initpath - Perform all necessary initialization of the search path,
+ *   which may be simply saving the path.
+ *
+ * Requires:
+ *   pathstr is the valid path from the environment, or NULL if PATH is
+ *   not set.
+ *
+ * Effects:
+ *   Splits the path into its directories, records each directory's
+ *   modification time, and empties the search path cache.  An empty
+ *   directory name means the current directory, and a NULL path means
+ *   DEFPATH, as with execvp.  If verbose output is selected, prints the
+ *   path.
+ */
+static void
+initpath(const char *pathstr)
+{	
+	const char *dir, *end;
+	int i;
+
+	if (verbose) {
+		if (pathstr == NULL) 
+			printf("Warning: Path is NULL!\n");
+		else
+			printf("Path= %s\n", pathstr);		
+	} 	
+
+	/* Forget the old search path and remember where this one came from. */
+	clearpathcache();
+	for (i = 0; i < npathdirs; i++)
+		free(pathdirs[i]);
+	free(pathdirs);
+	free(pathmtimes);
+	free(pathenv);
+	pathenv = pathstr != NULL ? strdup(pathstr) : NULL;
+	if (pathstr == NULL)
+		pathstr = DEFPATH;
+
+	/* Split the path at each ':'. */
+	npathdirs = 1;
+	for (dir = pathstr; *dir != '\0'; dir++)
+		if (*dir == ':')
+			npathdirs++;
+	if ((pathdirs = malloc(npathdirs * sizeof(char *))) == NULL ||
+	    (pathmtimes = calloc(npathdirs, sizeof(struct timespec))) == NULL)
+		unix_error("initpath: malloc error");
+	for (dir = pathstr, i = 0; i < npathdirs; dir = end + 1, i++) {
+		if ((end = strchr(dir, ':')) == NULL)
+			end = dir + strlen(dir);
+		if (end == dir)
+			pathdirs[i] = strdup(".");
+		else
+			pathdirs[i] = strndup(dir, end - dir);
+		if (pathdirs[i] == NULL)
+			unix_error("initpath: strdup error");
+	}
+	statpath();
+}
+
+/*
+ * do_hash - Execute the builtin hash command.
+ *
+ * Requires:
+ *  "argv" is the argument vector of a hash command.
+ *
+ * Effects:
+ *  With no arguments, lists the cached commands and how often each was
+ *  used.  "-r" empties the cache, "-d name" forgets "name", "-t name"
+ *  prints the path of "name", and any other name is looked up and added
+ *  to the cache.  Names that are not on the search path are reported
+ *  and remembered as misses.
+ */
+static void
+do_hash(char **argv)
+{
+	PathEntryP entry;
+	size_t i;
+	int argi;
+
+	checkpath();
+	if (argv[1] == NULL) {
+		if (npathentries == 0) {
+			printf("hash: hash table empty\n");
+			return;
+		}
+		printf("hits\tcommand\n");
+		for (i = 0; i < pathtabsize; i++) {
+			for (entry = pathtab[i]; entry != NULL;
+			    entry = entry->next) {
+				if (entry->path != NULL)
+					printf("%4d\t%s\n", entry->hits,
+					    entry->path);
+				else
+					printf("%4d\t%s (not found)\n",
+					    entry->hits, entry->name);
+			}
+		}
+		return;
+	}
+
+	for (argi = 1; argv[argi] != NULL; argi++) {
+		if (strcmp(argv[argi], "-r") == 0)
+			clearpathcache();
+		else if (strcmp(argv[argi], "-d") == 0 ||
+		    strcmp(argv[argi], "-t") == 0) {
+			if (argv[argi + 1] == NULL) {
+				printf("hash: %s: option requires an "
+				    "argument\n", argv[argi]);
+				return;
+			}
+			argi++;
+			if (argv[argi - 1][1] == 'd') {
+				if (getpathentry(argv[argi], false) == NULL)
+					printf("hash: %s: not found\n",
+					    argv[argi]);
+				else
+					deletepathentry(argv[argi]);
+			} else if (strchr(argv[argi], '/') != NULL)
+				printf("%s\n", argv[argi]);
+			else if ((entry = getpathentry(argv[argi], true))->path
+			    != NULL)
+				printf("%s\n", entry->path);
+			else
+				printf("hash: %s: not found\n", argv[argi]);
+		} else if (argv[argi][0] == '-') {
+			printf("hash: %s: invalid option\n", argv[argi]);
+			printf("hash: usage: hash [-r] [-d name] [-t name] "
+			    "[name ...]\n");
+			return;
+		} else if (strchr(argv[argi], '/') == NULL &&
+		    getpathentry(argv[argi], true)->path == NULL)
+			printf("hash: %s: not found\n", argv[argi]);
+	}
+}
+
+/*
+ * The signal handlers follow.  They are not installed with sigaction;
+ * the signals are blocked and read from "sigfd" by dispatch_signals,
+ * which calls the handlers synchronously from the read/eval loop or
+ * from waitfg.
+ */
+
+/*
+ * dispatch_signals - Read every pending signal from the signalfd and
+ *  run its handler.
+ *
+ * Requires:
+ *  "sigfd" is a non-blocking signalfd for the signals in "shell_sigs".
+ *
+ * Effects:
+ *  If "block" is true, first waits until at least one signal is pending.
+ *  Forwards each SIGINT and SIGTSTP to the foreground job and exits on
+ *  SIGQUIT.  Any number of SIGCHLDs are coalesced into a single call of
+ *  sigchld_handler, which reaps all children that have changed state.
+ *  Finally updates the jobs of the children reaped, as one batch.
+ */
+static void
+dispatch_signals(bool block)
+{
+	struct signalfd_siginfo info[32];
+	ssize_t nread;
+	size_t i;
+	bool child = false;
+
+	if (block)
+		pollsignals(-1);
+
+	while ((nread = read(sigfd, info, sizeof(info))) > 0) {
+		for (i = 0; i < nread / sizeof(info[0]); i++) {
+			TRACE(EV_SIGNAL, info[i].ssi_pid, 0,
+			    (int)info[i].ssi_signo);
+			switch (info[i].ssi_signo) {
+			case SIGCHLD:
+				child = true;
+				break;
+			case SIGINT:
+				sigint_handler(SIGINT);
+				break;
+			case SIGTSTP:
+				sigtstp_handler(SIGTSTP);
+				break;
+			case SIGQUIT:
+				sigquit_handler(SIGQUIT);
+				break;
+			}
+		}
+	}
+	if (nread == -1 && errno != EAGAIN && errno != EINTR)
+		unix_error("signalfd read error");
+
+	if (child)
+		sigchld_handler(SIGCHLD);
+	drainreaps();
+}
+
+/*
+ * pollsignals
+ *
+ * Requires:
+ *  "sigfd" is a signalfd for the signals in "shell_sigs", and "fd" is
+ *  -1 or an open file descriptor.
+ *
+ * Effects:
+ *  Flushes standard output and the trace, then waits until a signal is
+ *  pending or, unless "fd" is -1, until "fd" is readable.  Returns
+ *  whether "fd" is readable.
+ */
+static bool
+pollsignals(int fd)
+{
+	struct pollfd pfd[2];
+
+	fflush(stdout);
+	traceflush();
+	pfd[0].fd = sigfd;
+	pfd[1].fd = fd;
+	pfd[0].events = pfd[1].events = POLLIN;
+	pfd[1].revents = 0;
+	while (poll(pfd, fd != -1 ? 2 : 1, -1) == -1)
+		if (errno != EINTR)
+			unix_error("poll error");
+	return ((pfd[1].revents & POLLIN) != 0);
+}
+
+/* 
+ * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
+ *  a child job terminates (becomes a zombie), or stops because it
+ *  received a SIGSTOP or SIGTSTP signal.  The handler reaps all
+ *  available zombie children, but doesn't wait for any other
+ *  currently running children to terminate.  Because SIGCHLDs are
+ *  coalesced, one call may reap many children.
+ *
+ * Requires:
+ *  A signal number
+ *
+ * Effects:
+ *  Reaps terminated and stopped children into "reapq", leaving the job
+ *  list and the messages to drainreaps.  If "reapq" fills up, drains it
+ *  and goes on reaping, so no child is left behind.
+ */
+static void
+sigchld_handler(int signum)
+{
+	assert(signum == SIGCHLD);
+	struct ReapEvent *ev;	/* the slot for the next reaped child */
+
+	/* make sure the given signal is a SIGCHLD signal */
+	if (signum == SIGCHLD) {
+		
+		/* Handle reaping of all terminated child and handle
+		 * stopped children
+		 */
+		for (;;) {
+			if ((ev = reapslot()) == NULL) {
+				drainreaps();
+				continue;
+			}
+			if ((ev->pid = wait4(-1, &ev->status,
+			    WNOHANG | WUNTRACED, &ev->ru)) <= 0)
+				break;
+			clock_gettime(CLOCK_MONOTONIC, &ev->time);
+			pushreap();
+		}
+	}
+
+	return;
+}
+
+/*
+ * reapjob
+ *
+ * Requires:
+ *  "job" has been started, and its pidfd is readable.
+ *
+ * Effects:
+ *  Reaps the job's process, which has terminated, into "reapq" without
+ *  waiting for any other child.
+ */
+static void
+reapjob(JobP job)
+{
+	struct ReapEvent *ev;
+
+	if ((ev = reapslot()) == NULL) {
+		drainreaps();
+		ev = reapslot();
+	}
+	if ((ev->pid = wait4(job->pid, &ev->status, WNOHANG | WUNTRACED,
+	    &ev->ru)) > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &ev->time);
+		pushreap();
+	}
+}
+
+/*
+ * reapslot
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Returns the slot of "reapq" that the next reaped child is written
+ *  to, or NULL if the ring is full.  The slot belongs to the producer
+ *  until pushreap publishes it.
+ */
+static struct ReapEvent *
+reapslot(void)
+{
+
+	if (reapq.tail - reapq.head == REAPRING)
+		return (NULL);
+	return (&reapq.events[reapq.tail & (REAPRING - 1)]);
+}
+
+/*
+ * pushreap
+ *
+ * Requires:
+ *  The slot returned by reapslot has been filled in.
+ *
+ * Effects:
+ *  Publishes the slot to drainreaps.
+ */
+static void
+pushreap(void)
+{
+
+	reapq.tail++;
+}
+
+/*
+ * drainreaps
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Updates the jobs of every child in "reapq", oldest first, and then
+ *  starts queued jobs in the slots that were freed.  The reap loop
+ *  fills "reapq" and this function empties it, both on the shell's
+ *  only thread, so the ring needs no atomics or locks.
+ */
+static void
+drainreaps(void)
+{
+
+	if (reapq.head == reapq.tail)
+		return;
+	for (; reapq.head != reapq.tail; reapq.head++)
+		reapchild(&reapq.events[reapq.head & (REAPRING - 1)]);
+
+	/* Start queued jobs in the slots that were freed. */
+	startqueued();
+}
+
+/*
+ * reapchild
+ *
+ * Requires:
+ *  "ev" is the reap event of a child.
+ *
+ * Effects:
+ *  Changes the state of a stopped child's job to ST, and removes the
+ *  job of a terminated child from the jobs list, recording it and
+ *  reporting its usage if it was started by "time".  Prints a message
+ *  if the child was stopped or terminated by a signal.
+ */
+static void
+reapchild(const struct ReapEvent *ev)
+{
+	pid_t pid = ev->pid;
+	int status = ev->status;
+	JobP fgJob = getjobpid(&jobs, pid);
+	struct DoneJob *done;	/* the record of a child that ended */
+	char name[SIG2STR_MAX + 3];	/* the name of a signal */
+
+	TRACE(EV_REAP, pid, fgJob != NULL ? fgJob->jid : 0, status);
+
+	/* A batch exits with status 1 if a command failed. */
+	if (fgJob != NULL && (WIFSIGNALED(status) ||
+	    (WIFEXITED(status) && WEXITSTATUS(status) != 0)))
+		nfailed++;
+
+	if (verbose)
+		printf("Handler handling child %d\n", (int)pid);
+	
+	/* If stopped, move the process to the background, and print the
+	 * process if it was stopped or terminated due to a signal. Remove
+	 * the job from the list if it was terminated.
+	 */
+	if (WIFSTOPPED(status) && fgJob != NULL) {
+		
+		setjobstate(&jobs, fgJob, ST);
+		printf("Job [%d] (%d) stopped by signal %s\n",
+		    pid2jid(fgJob->pid), fgJob->pid,
+		    signame(WSTOPSIG(status), name));
+		    
+	} else if (WIFSIGNALED(status) && fgJob != NULL) {
+		
+		printf("Job [%d] (%d) terminated by signal %s\n",
+		    pid2jid(fgJob->pid), fgJob->pid,
+		    signame(WTERMSIG(status), name));
+	}
+
+	/* Record a terminated job, reporting its usage if it was started
+	 * by "time".
+	 */
+	if (!WIFSTOPPED(status) && fgJob != NULL) {
+		done = recordjob(fgJob, ev);
+		if (fgJob->timed)
+			printtimes(&done->usage);
+		if (bench != NULL && bench->cmdline != NULL &&
+		    done->cmdline == bench->cmdline) {
+			bench->running--;
+			benchsample(bench, (done->usage.end.tv_sec -
+			    done->usage.start.tv_sec) +
+			    (done->usage.end.tv_nsec -
+			    done->usage.start.tv_nsec) / 1e9);
+		}
+		deletejob(&jobs, pid);
+	}
+}
+
+/* 
+ * sigint_handler - The kernel sends a SIGINT to the shell whenever the
+ *  user types ctrl-c at the keyboard.  Catch it and send it along
+ *  to the foreground job.  
+ *
+ * Requires:
+ *  Signal number
+ *
+ * Effects:
+ *  Catches an interrupt signal and sends it to the foreground job
+ */
+static void
+sigint_handler(int sig) 
+{	
+	if (sig != SIGINT) {
+		if (verbose)
+			printf("Error: SIGINT not received!\n");
+	}
+	/* Ensure that there is a job running in the foreground and forward
+	 * the interrupt signal to it, otherwise don't do anything
+	 */
+	else {
+		/* Interrupt a bench command after its current runs. */
+		if (bench != NULL)
+			bench->stop = true;
+
+		/* Cancel a foreground command waiting for a job slot. */
+		if (slotwait)
+			slotcancel = true;
+
+		pid_t fg_pid = fgpid(&jobs);
+		if (!fg_pid) {
+			if (verbose)
+				printf("Error: No such job to STOP!\n");
+			return;
+		}
+
+		/*
+		 * A job that has exited but is not yet reaped gives ESRCH,
+		 * which is not an error.
+		 */
+		JobP fgJob = getjobpid(&jobs, fg_pid);
+		if (fgJob == NULL ||
+		    (signaljob(fgJob, sig) == -1 && errno != ESRCH))
+			unix_error("Unable to forward SIGINT!\n");
+	}
+	
+	return;
+}
+
+/*
+ * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
+ *  the user types ctrl-z at the keyboard.  Catch it and suspend the
+ *  foreground job by sending it a SIGTSTP.  
+ *
+ * Requires:
+ *  Signal number
+ *
+ * Effects:
+ *  Catches a TSTP signal and sends it to the foreground job
+ */
+static void
+sigtstp_handler(int sig) 
+{
+	if (sig != SIGTSTP) {
+		if (verbose)
+			printf("Error: SIGTSTP not received!\n");
+	}
+	/* Ensure that there is a job running in the foreground and 
+	 * forward the tstp signal to it, otherwise don't do anything
+	 */
+	else {
+		/* Cancel a foreground command waiting for a job slot. */
+		if (slotwait)
+			slotcancel = true;
+
+		pid_t fg_pid = fgpid(&jobs);
+		if (!fg_pid) {
+			if (verbose)
+				printf("Error: No such job to STOP!\n");
+			return;
+		}
+
+		JobP fgJob = getjobpid(&jobs, fg_pid);	
+		if (fgJob == NULL ||
+		    (signaljob(fgJob, sig) == -1 && errno != ESRCH))
+			unix_error("Unable to forward SIGTSTP!\n"); 
+	}
+	return;
+}
+
+/*
+ * sigquit_handler - The driver program can gracefully terminate the
+ *  child shell by sending it a SIGQUIT signal.
+ *
+ * Requires:
+ *  "signum" is SIGQUIT.
+ *
+ * Effects:
+ *  Terminates the program.
+ */
+static void
+sigquit_handler(int signum)
+{
+
+	assert(signum == SIGQUIT);
+	printf("Terminating after receipt of SIGQUIT signal\n");
+	exit(1);
+}
+
+/*
+ * This comment marks the end of the signal handlers.
+ */
+
+/*
+ * The following helper routines manipulate the jobs list.
+ */
+
+/*
+ * clearjob
+ *
+ * Requires:
+ *  "job" points to a job structure.
+ *
+ * Effects:
+ *  Clears the fields in the referenced job structure.
+ */
+static void
+clearjob(JobP job)
+{
+
+	job->pid = 0;
+	job->jid = 0;
+	job->state = UNDEF;
+	job->out = -1;
+	job->timed = false;
+	job->pidfd = -1;
+	job->tmodes = NULL;
+	job->prev = job->next = NULL;
+	job->cmdline = NULL;
+	job->start = 0;
+}
+
+/*
+ * initjobs
+ * 
+ * Requires:
+ *  "jobs" points to a job list structure.
+ *
+ * Effects:
+ *  Initializes the jobs list to an empty state.
+ */
+static void
+initjobs(JobListP jobs)
+{
+	int i;
+
+	jobs->first = jobs->last = jobs->fg = jobs->queued = jobs->free =
+	    NULL;
+	jobs->pidindex = jobs->jidindex = NULL;
+	jobs->indexsize = 0;
+	jobs->njobs = 0;
+	for (i = 0; i <= QU; i++)
+		jobs->nstate[i] = 0;
+	for (i = 0; i < MAXJID / 64; i++)
+		setjid(jobs, 64 * i, false);
+	setjid(jobs, 0, true);  /* Job ID 0 is never allocated. */
+}
+
+/*
+ * maxjid
+ *
+ * Requires:
+ *  "jobs" points to an initialized job list.
+ *
+ * Effects:
+ *  Returns the largest allocated job ID, or 0 if there is none.  Scans
+ *  at most MAXJID / 4096 summary words.
+ */
+static int
+maxjid(JobListP jobs) 
+{
+	int i, word;
+
+	for (i = MAXJID / 4096 - 1; jobs->jidused[i] == 0; i--)
+		;       /* Job ID 0 is always marked, so this terminates. */
+	word = 64 * i + 63 - __builtin_clzll(jobs->jidused[i]);
+	return (64 * word + 63 - __builtin_clzll(jobs->jidmap[word]));
+}
+
+/*
+ * allocjid
+ *
+ * Requires:
+ *  "jobs" points to an initialized job list.
+ *
+ * Effects:
+ *  Allocates and returns the job ID after the largest one in use or,
+ *  once that would reach MAXJID, the smallest unused job ID, as bash
+ *  does.  Returns 0 if every job ID is in use.
+ */
+static int
+allocjid(JobListP jobs)
+{
+	int i, jid, word;
+
+	if ((jid = maxjid(jobs) + 1) >= MAXJID) {
+		for (i = 0; i < MAXJID / 4096 && jobs->jidavail[i] == 0; i++)
+			;
+		if (i == MAXJID / 4096)
+			return (0);
+		word = 64 * i + __builtin_ctzll(jobs->jidavail[i]);
+		jid = 64 * word + __builtin_ctzll(~jobs->jidmap[word]);
+	}
+	setjid(jobs, jid, true);
+	return (jid);
+}
+
+/*
+ * setjid
+ *
+ * Requires:
+ *  "jobs" points to a job list and 0 <= "jid" < MAXJID.
+ *
+ * Effects:
+ *  Marks "jid" as used or unused and updates the summary words that
+ *  record which words of the job ID map are nonzero and non-full.
+ */
+static void
+setjid(JobListP jobs, int jid, bool used)
+{
+	int word = jid / 64;
+	uint64_t bit = (uint64_t)1 << (word % 64);
+
+	if (used)
+		jobs->jidmap[word] |= (uint64_t)1 << (jid % 64);
+	else
+		jobs->jidmap[word] &= ~((uint64_t)1 << (jid % 64));
+	if (jobs->jidmap[word] != 0)
+		jobs->jidused[word / 64] |= bit;
+	else
+		jobs->jidused[word / 64] &= ~bit;
+	if (jobs->jidmap[word] != UINT64_MAX)
+		jobs->jidavail[word / 64] |= bit;
+	else
+		jobs->jidavail[word / 64] &= ~bit;
+}
+
+/*
+ * addjob
+ *
+ * Requires:
+ *  "jobs" points to an initialized job list, and "cmdline" holds "len"
+ *  bytes, which need not be NUL-terminated.
+ *
+ * Effects: 
+ *  Adds a job to the end of the jobs list, growing the list's indexes
+ *  when they become half full, and returns it.  The PID of a job that
+ *  has not been started yet is 0; startjob sets it.  Returns NULL if
+ *  there is no free job ID.
+ */
+static JobP
+addjob(JobListP jobs, pid_t pid, int state, const char *cmdline, size_t len)
+{
+	JobP job, slab;
+	size_t i;
+	int jid;
+    
+	if (pid < 0)
+		return (NULL);
+	if ((jid = allocjid(jobs)) == 0) {
+		printf("Tried to create too many jobs\n");
+		return (NULL);
+	}
+
+	/* Keep the indexes at most half full. */
+	if (2 * (jobs->njobs + 1) > jobs->indexsize) {
+		free(jobs->pidindex);
+		free(jobs->jidindex);
+		jobs->indexsize = jobs->indexsize > 0 ? 2 * jobs->indexsize :
+		    2 * JOBSLAB;
+		if ((jobs->pidindex = calloc(jobs->indexsize, sizeof(JobP))) ==
+		    NULL || (jobs->jidindex = calloc(jobs->indexsize,
+		    sizeof(JobP))) == NULL)
+			unix_error("addjob: calloc error");
+		for (job = jobs->first; job != NULL; job = job->next) {
+			if (job->pid > 0)
+				indexjob(jobs->pidindex, jobs->indexsize, job,
+				    true);
+			indexjob(jobs->jidindex, jobs->indexsize, job, false);
+		}
+	}
+
+	/* Take a record from the free list, refilling it a slab at a time. */
+	if (jobs->free == NULL) {
+		if ((slab = malloc(JOBSLAB * sizeof(struct Job))) == NULL)
+			unix_error("addjob: malloc error");
+		for (i = 0; i < JOBSLAB; i++) {
+			clearjob(&slab[i]);
+			slab[i].next = jobs->free;
+			jobs->free = &slab[i];
+		}
+	}
+	job = jobs->free;
+	jobs->free = job->next;
+
+	job->pid = pid;
+	job->state = UNDEF;
+	job->out = -1;
+	job->timed = false;
+	job->pidfd = -1;
+	job->tmodes = NULL;
+	job->jid = jid;
+	job->cmdline = internline(cmdline, len);
+	job->prev = jobs->last;
+	job->next = NULL;
+	if (jobs->last != NULL)
+		jobs->last->next = job;
+	else
+		jobs->first = job;
+	jobs->last = job;
+	jobs->njobs++;
+	jobs->nstate[UNDEF]++;
+	if (pid > 0)
+		indexjob(jobs->pidindex, jobs->indexsize, job, true);
+	indexjob(jobs->jidindex, jobs->indexsize, job, false);
+	setjobstate(jobs, job, state);
+	if (verbose) {
+		printf("Added job [%d] %d %s", job->jid, (int)job->pid,
+		    job->cmdline);
+		printf("Job memory: %zu + %zu bytes, %zu command lines "
+		    "interned\n", sizeof(struct Job), sizeof(struct CmdLine) +
+		    strlen(job->cmdline) + 1, ncmdlines);
+	}
+	return (job);
+}
+
+/*
+ * deletejob 
+ * 
+ * Requires:
+ *  "jobs" points to an initialized job list.
+ *
+ * Effects:
+ *  Deletes a job from the jobs list whose PID equals "pid".
+ */
+static int
+deletejob(JobListP jobs, pid_t pid) 
+{
+	JobP job;
+
+	if ((job = getjobpid(jobs, pid)) == NULL)
+		return (0);
+	removejob(jobs, job);
+	return (1);
+}
+
+/*
+ * removejob
+ *
+ * Requires:
+ *  "jobs" points to an initialized job list containing "job".
+ *
+ * Effects:
+ *  Deletes "job", which need not have been started, from the jobs list.
+ */
+static void
+removejob(JobListP jobs, JobP job)
+{
+
+	setjobstate(jobs, job, UNDEF);
+	jobs->nstate[UNDEF]--;
+	if (job->out >= 0)
+		endoutput(job->out);
+	if (job->pid > 0)
+		unindexjob(jobs->pidindex, jobs->indexsize, job, true);
+	unindexjob(jobs->jidindex, jobs->indexsize, job, false);
+	if (job->prev != NULL)
+		job->prev->next = job->next;
+	else
+		jobs->first = job->next;
+	if (job->next != NULL)
+		job->next->prev = job->prev;
+	else
+		jobs->last = job->prev;
+	jobs->njobs--;
+	setjid(jobs, job->jid, false);
+	releaseline(job->cmdline);
+	free(job->tmodes);
+	if (job->pidfd != -1)
+		close(job->pidfd);
+	clearjob(job);
+	job->next = jobs->free;
+	jobs->free = job;
+}
+
+/*
+ * setjobstate
+ *
+ * Requires:
+ *  "jobs" points to an initialized job list containing "job".
+ *
+ * Effects:
+ *  Sets the state of "job", keeping track of the foreground job, the
+ *  oldest queued job, and the number of jobs in each state.  A job can
+ *  only be queued while it is the newest job.
+ */
+static void
+setjobstate(JobListP jobs, JobP job, int state)
+{
+
+	if (job->state == FG && jobs->fg == job)
+		jobs->fg = NULL;
+	if (job->state == QU && jobs->queued == job)
+		jobs->queued = job->next;  /* The queue ends the list. */
+	if (state != job->state)
+		TRACE(EV_STATE, job->pid, job->jid, state);
+	jobs->nstate[job->state]--;
+	job->state = state;
+	jobs->nstate[state]++;
+	if (state == FG)
+		jobs->fg = job;
+	if (state == QU && jobs->queued == NULL)
+		jobs->queued = job;
+}
+
+/*
+ * fgpid
+ * 
+ * Requires:
+ *  "jobs" points to an initialized job list.
+ *
+ * Effects:
+ *  Returns the PID of the current foreground job or 0 if no foreground
+ *  job exists.
+ */
+static pid_t
+fgpid(JobListP jobs)
+{
+
+	return (jobs->fg != NULL ? jobs->fg->pid : 0);
+}
+
+/*
+ * getjobpid
+ * 
+ * Requires:
+ *  "jobs" points to an initialized job list.
+ *
+ * Effects:
+ *  Returns a pointer to the job structure with process ID "pid" or NULL if
+ *  no such job exists.
+ */
+static JobP
+getjobpid(JobListP jobs, pid_t pid)
+{
+
+	if (pid < 1 || jobs->indexsize == 0)
+		return (NULL);
+	return (*jobslot(jobs->pidindex, jobs->indexsize, pid, true));
+}
+
+/*
+ * getjobjid 
+ * 
+ * Requires:
+ *  "jobs" points to an initialized job list.
+ *
+ * Effects:
+ *  Returns a pointer to the job structure with job ID "jid" or NULL if no
+ *  such job exists.
+ */
+static JobP
+getjobjid(JobListP jobs, int jid) 
+{
+
+	if (jid < 1 || jobs->indexsize == 0)
+		return (NULL);
+	return (*jobslot(jobs->jidindex, jobs->indexsize, jid, false));
+}
+
+/*
+ * pid2jid 
+ * 
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Returns the job ID for the job with process ID "pid" or 0 if no such
+ *  job exists.
+ */
+static int
+pid2jid(pid_t pid) 
+{
+	JobP job;
+
+	if ((job = getjobpid(&jobs, pid)) == NULL)
+		return (0);
+	return (job->jid);
+}
+
+/*
+ * listjobs
+ *
+ * Requires:
+ *  "jobs" points to an initialized job list.
+ *
+ * Effects:
+ *  Prints the jobs list, with the resources that each job has used if
+ *  "details" is true.
+ */
+static void
+listjobs(JobListP jobs, bool details) 
+{
+	JobP job;
+
+	for (job = jobs->first; job != NULL; job = job->next)
+		printjob(job, details);
+}
+
+/*
+ * printjob
+ *
+ * Requires:
+ *  "job" points to a job in the jobs list.
+ *
+ * Effects:
+ *  Prints the job's ID, PID, state and command line.  If "details" is
+ *  true and the job has been started, also prints the resources its
+ *  process has used so far, as sampled from /proc.
+ */
+static void
+printjob(JobP job, bool details)
+{
+	struct JobUsage usage;
+
+	printf("[%d] (%d) ", job->jid, (int)job->pid);
+	switch (job->state) {
+	case BG: 
+		printf("Running ");
+		break;
+	case FG: 
+		printf("Foreground ");
+		break;
+	case ST: 
+		printf("Stopped ");
+		break;
+	case QU:
+		printf("Queued ");
+		break;
+	default:
+		printf("listjobs: Internal error: "
+		    "job[%d].state=%d ", job->jid, job->state);
+	}
+	printf("%s", job->cmdline);
+	if (details && job->pid > 0 && sampleusage(job, &usage))
+		printusage(&usage);
+}
+
+/*
+ * recordjob
+ *
+ * Requires:
+ *  "ev" is the reap event of "job", which has terminated.
+ *
+ * Effects:
+ *  Records the job in "donejobs", replacing the oldest record once
+ *  DONEJOBS jobs have completed, and returns the record.  The job ended
+ *  when it was reaped.
+ */
+static struct DoneJob *
+recordjob(JobP job, const struct ReapEvent *ev)
+{
+	const struct rusage *ru = &ev->ru;
+	struct DoneJob *done = &donejobs[ndone++ & (DONEJOBS - 1)];
+
+	if (done->cmdline != NULL)
+		releaseline(done->cmdline);
+	done->pid = job->pid;
+	done->jid = job->jid;
+	done->status = ev->status;
+	done->cmdline = holdline(job->cmdline);
+	done->usage.start.tv_sec = job->start / 1000000000;
+	done->usage.start.tv_nsec = job->start % 1000000000;
+	done->usage.end = ev->time;
+	done->usage.utime = ru->ru_utime;
+	done->usage.stime = ru->ru_stime;
+	done->usage.maxrss = ru->ru_maxrss;
+	done->usage.minflt = ru->ru_minflt;
+	done->usage.majflt = ru->ru_majflt;
+	done->usage.nvcsw = ru->ru_nvcsw;
+	done->usage.nivcsw = ru->ru_nivcsw;
+	return (done);
+}
+
+/*
+ * listdone
+ *
+ * Requires:
+ *  "specs" is a NULL-terminated array of PIDs and %jobids.
+ *
+ * Effects:
+ *  Prints the remembered completed jobs, oldest first, with how each
+ *  one ended and, if "details" is true, the resources it used.  If
+ *  "specs" is not empty, prints only the jobs that it names.
+ */
+static void
+listdone(bool details, char **specs)
+{
+	struct DoneJob *done;
+	char name[SIG2STR_MAX + 3];
+	size_t i;
+
+	for (i = ndone > DONEJOBS ? ndone - DONEJOBS : 0; i < ndone; i++) {
+		done = &donejobs[i & (DONEJOBS - 1)];
+		if (*specs != NULL && !jobmatches(specs, done->pid, done->jid))
+			continue;
+		printf("[%d] (%d) ", done->jid, (int)done->pid);
+		if (WIFSIGNALED(done->status))
+			printf("Killed %s ", signame(WTERMSIG(done->status),
+			    name));
+		else if (WEXITSTATUS(done->status) != 0)
+			printf("Exit %d ", WEXITSTATUS(done->status));
+		else
+			printf("Done ");
+		printf("%s", done->cmdline);
+		if (details)
+			printusage(&done->usage);
+	}
+}
+
+/*
+ * sampleusage
+ *
+ * Requires:
+ *  "job" has been started.
+ *
+ * Effects:
+ *  Fills "usage" with the resources that the job's process has used so
+ *  far, read from /proc/<pid>/stat and /proc/<pid>/status.  Returns
+ *  false if the process cannot be read, for example because it has
+ *  already exited.
+ */
+static bool
+sampleusage(JobP job, struct JobUsage *usage)
+{
+	static long ticks = 0;
+	unsigned long utime, stime, minflt, majflt;
+	char file[32], buf[4096], *field;
+	ssize_t nread;
+	int fd;
+
+	if (ticks == 0)
+		ticks = sysconf(_SC_CLK_TCK);
+	usage->start.tv_sec = job->start / 1000000000;
+	usage->start.tv_nsec = job->start % 1000000000;
+	clock_gettime(CLOCK_MONOTONIC, &usage->end);
+
+	/* The fields after the command name, which may contain spaces,
+	 * are counted from its closing parenthesis.
+	 */
+	snprintf(file, sizeof(file), "/proc/%d/stat", (int)job->pid);
+	if ((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1)
+		return (false);
+	nread = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (nread <= 0)
+		return (false);
+	buf[nread] = '\0';
+	if ((field = strrchr(buf, ')')) == NULL || sscanf(field + 1,
+	    " %*c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu", &minflt,
+	    &majflt, &utime, &stime) != 4)
+		return (false);
+	usage->minflt = minflt;
+	usage->majflt = majflt;
+	usage->utime.tv_sec = utime / ticks;
+	usage->utime.tv_usec = utime % ticks * 1000000 / ticks;
+	usage->stime.tv_sec = stime / ticks;
+	usage->stime.tv_usec = stime % ticks * 1000000 / ticks;
+
+	usage->maxrss = usage->nvcsw = usage->nivcsw = 0;
+	snprintf(file, sizeof(file), "/proc/%d/status", (int)job->pid);
+	if ((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1)
+		return (true);
+	nread = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (nread <= 0)
+		return (true);
+	buf[nread] = '\0';
+	for (field = buf; field != NULL; field = strchr(field, '\n')) {
+		field += field != buf;
+		if (strncmp(field, "VmHWM:", 6) == 0)
+			usage->maxrss = strtol(&field[6], NULL, 10);
+		else if (strncmp(field, "voluntary_ctxt_switches:", 24) == 0)
+			usage->nvcsw = strtol(&field[24], NULL, 10);
+		else if (strncmp(field, "nonvoluntary_ctxt_switches:", 27) ==
+		    0)
+			usage->nivcsw = strtol(&field[27], NULL, 10);
+	}
+	return (true);
+}
+
+/*
+ * printusage
+ *
+ * Requires:
+ *  "usage" points to a filled job usage.
+ *
+ * Effects:
+ *  Prints the usage on an indented line: the wall clock time of day
+ *  when the job started, its elapsed, user and system times, its
+ *  maximum resident set size, its page faults (major/minor) and its
+ *  context switches (voluntary/involuntary).
+ */
+static void
+printusage(const struct JobUsage *usage)
+{
+	struct timespec now, mono;
+	struct tm tm;
+	time_t started;
+	double real;
+
+	/* Convert the start time to the time of day. */
+	clock_gettime(CLOCK_REALTIME, &now);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	started = now.tv_sec - (mono.tv_sec - usage->start.tv_sec);
+	localtime_r(&started, &tm);
+	real = (usage->end.tv_sec - usage->start.tv_sec) +
+	    (usage->end.tv_nsec - usage->start.tv_nsec) / 1e9;
+
+	printf("    start %02d:%02d:%02d real %.3fs user %.3fs sys %.3fs "
+	    "maxrss %ldK faults %ld/%ld csw %ld/%ld\n", tm.tm_hour,
+	    tm.tm_min, tm.tm_sec, real, usage->utime.tv_sec +
+	    usage->utime.tv_usec / 1e6, usage->stime.tv_sec +
+	    usage->stime.tv_usec / 1e6, usage->maxrss, usage->majflt,
+	    usage->minflt, usage->nvcsw, usage->nivcsw);
+}
+
+/*
+ * printtimes
+ *
+ * Requires:
+ *  "usage" points to a filled job usage.
+ *
+ * Effects:
+ *  Prints the report of the "time" keyword: the elapsed, user and
+ *  system times, the maximum resident set size, and the voluntary and
+ *  involuntary context switches.
+ */
+static void
+printtimes(const struct JobUsage *usage)
+{
+
+	printf("real %.3fs user %.3fs sys %.3fs maxrss %ldK csw %ld/%ld\n",
+	    (usage->end.tv_sec - usage->start.tv_sec) +
+	    (usage->end.tv_nsec - usage->start.tv_nsec) / 1e9,
+	    usage->utime.tv_sec + usage->utime.tv_usec / 1e6,
+	    usage->stime.tv_sec + usage->stime.tv_usec / 1e6,
+	    usage->maxrss, usage->nvcsw, usage->nivcsw);
+}
+
+/*
+ * endusage
+ *
+ * Requires:
+ *  "usage->start" is the time at which a command started running in
+ *  the shell, and "before" is the shell's own usage at that time.
+ *
+ * Effects:
+ *  Fills the rest of "usage" with what the command used: the shell's
+ *  usage since "before", except that the maximum resident set size is
+ *  the shell's own.  Returns "usage".
+ */
+static struct JobUsage *
+endusage(struct JobUsage *usage, const struct rusage *before)
+{
+	struct rusage after;
+
+	clock_gettime(CLOCK_MONOTONIC, &usage->end);
+	getrusage(RUSAGE_SELF, &after);
+	timersub(&after.ru_utime, &before->ru_utime, &usage->utime);
+	timersub(&after.ru_stime, &before->ru_stime, &usage->stime);
+	usage->maxrss = after.ru_maxrss;
+	usage->minflt = after.ru_minflt - before->ru_minflt;
+	usage->majflt = after.ru_majflt - before->ru_majflt;
+	usage->nvcsw = after.ru_nvcsw - before->ru_nvcsw;
+	usage->nivcsw = after.ru_nivcsw - before->ru_nivcsw;
+	return (usage);
+}
+
+/*
+ * jobmatches
+ *
+ * Requires:
+ *  "specs" is a NULL-terminated array of PIDs and %jobids.
+ *
+ * Effects:
+ *  Returns whether any of "specs" names the job with "pid" and "jid".
+ */
+static bool
+jobmatches(char **specs, pid_t pid, int jid)
+{
+
+	for (; *specs != NULL; specs++) {
+		if ((*specs)[0] == '%' ? atoi(&(*specs)[1]) == jid :
+		    atoi(*specs) == pid)
+			return (true);
+	}
+	return (false);
+}
+
+/*
+ * internline
+ *
+ * Requires:
+ *  "cmdline" holds "len" bytes, which need not be NUL-terminated.
+ *
+ * Effects:
+ *  Returns a shared, NUL-terminated copy of "cmdline", adding a
+ *  reference to the copy if one already exists.  Jobs started from the
+ *  same command line share one copy.
+ */
+static const char *
+internline(const char *cmdline, size_t len)
+{
+	CmdLineP line, next, *oldtab;
+	unsigned long hash = hashbytes(cmdline, len);
+	size_t i, oldsize;
+
+	if (cmdtabsize > 0) {
+		for (line = cmdtab[hash & (cmdtabsize - 1)]; line != NULL;
+		    line = line->next) {
+			if (line->hash == hash && line->len == len &&
+			    memcmp(line->text, cmdline, len) == 0) {
+				line->refs++;
+				return (line->text);
+			}
+		}
+	}
+
+	/* Double the number of buckets once they average one line. */
+	if (ncmdlines >= cmdtabsize) {
+		oldtab = cmdtab;
+		oldsize = cmdtabsize;
+		cmdtabsize = oldsize > 0 ? oldsize * 2 : 64;
+		if ((cmdtab = calloc(cmdtabsize, sizeof(CmdLineP))) == NULL)
+			unix_error("internline: calloc error");
+		for (i = 0; i < oldsize; i++) {
+			for (line = oldtab[i]; line != NULL; line = next) {
+				next = line->next;
+				line->next = cmdtab[line->hash &
+				    (cmdtabsize - 1)];
+				cmdtab[line->hash & (cmdtabsize - 1)] = line;
+			}
+		}
+		free(oldtab);
+	}
+
+	if ((line = malloc(sizeof(struct CmdLine) + len + 1)) == NULL)
+		unix_error("internline: malloc error");
+	memcpy(line->text, cmdline, len);
+	line->text[len] = '\0';
+	line->len = len;
+	line->hash = hash;
+	line->refs = 1;
+	line->next = cmdtab[hash & (cmdtabsize - 1)];
+	cmdtab[hash & (cmdtabsize - 1)] = line;
+	ncmdlines++;
+	return (line->text);
+}
+
+/*
+ * releaseline
+ *
+ * Requires:
+ *  "cmdline" was returned by internline and has not been released as
+ *  many times as it was returned.
+ *
+ * Effects:
+ *  Drops a reference to "cmdline", freeing it with its last reference.
+ */
+static void
+releaseline(const char *cmdline)
+{
+	CmdLineP line, *prevp;
+
+	line = (CmdLineP)(cmdline - offsetof(struct CmdLine, text));
+	if (--line->refs > 0)
+		return;
+	for (prevp = &cmdtab[line->hash & (cmdtabsize - 1)]; *prevp != line;
+	    prevp = &(*prevp)->next)
+		;
+	*prevp = line->next;
+	free(line);
+	ncmdlines--;
+}
+
+/*
+ * holdline
+ *
+ * Requires:
+ *  "cmdline" was returned by internline and has not been released.
+ *
+ * Effects:
+ *  Adds a reference to "cmdline" and returns it.
+ */
+static const char *
+holdline(const char *cmdline)
+{
+
+	((CmdLineP)(cmdline - offsetof(struct CmdLine, text)))->refs++;
+	return (cmdline);
+}
+
+/*
+ * jobslot
+ *
+ * Requires:
+ *  "index" is an open-addressed index of "size" slots, a power of two,
+ *  that is keyed by PID if "bypid" is true and by job ID otherwise, and
+ *  has at least one empty slot.
+ *
+ * Effects:
+ *  Returns the slot holding the job with the given key or, if there is
+ *  none, the empty slot where such a job would be inserted.
+ */
+static JobP *
+jobslot(JobP *index, size_t size, int key, bool bypid)
+{
+	size_t i;
+
+	for (i = (size_t)key * 2654435761U & (size - 1); index[i] != NULL;
+	    i = (i + 1) & (size - 1))
+		if ((bypid ? index[i]->pid : index[i]->jid) == key)
+			break;
+	return (&index[i]);
+}
+
+/*
+ * indexjob
+ *
+ * Requires:
+ *  "index" is as for jobslot and does not contain "job".
+ *
+ * Effects:
+ *  Inserts "job" into "index".
+ */
+static void
+indexjob(JobP *index, size_t size, JobP job, bool bypid)
+{
+
+	*jobslot(index, size, bypid ? job->pid : job->jid, bypid) = job;
+}
+
+/*
+ * unindexjob
+ *
+ * Requires:
+ *  "index" is as for jobslot and contains "job".
+ *
+ * Effects:
+ *  Removes "job" from "index", moving later jobs in the same probe
+ *  sequence back so that linear probing still finds them.
+ */
+static void
+unindexjob(JobP *index, size_t size, JobP job, bool bypid)
+{
+	size_t hole, i, home;
+
+	hole = jobslot(index, size, bypid ? job->pid : job->jid, bypid) -
+	    index;
+	index[hole] = NULL;
+	for (i = (hole + 1) & (size - 1); index[i] != NULL;
+	    i = (i + 1) & (size - 1)) {
+		home = (size_t)(bypid ? index[i]->pid : index[i]->jid) *
+		    2654435761U & (size - 1);
+		/* Move the entry if its home is not between hole and i. */
+		if (((i - home) & (size - 1)) >= ((i - hole) & (size - 1))) {
+			index[hole] = index[i];
+			index[i] = NULL;
+			hole = i;
+		}
+	}
+}
+
+/*
+ * This comment marks the end of the jobs list helper routines.
+ */
+
+/*
+ * The following helper routines launch jobs.
+ */
+
+/*
+ * initlaunch
+ *
+ * Requires:
+ *  "shell_sigs" holds the signals that the shell blocks.
+ *
+ * Effects:
+ *  Prepares the posix_spawn attributes used by the SPAWN engine, so that
+ *  launching a job does not rebuild them: the child gets its own process
+ *  group, an empty signal mask and default actions for the shell's
+ *  signals and for SIGTTIN and SIGTTOU, which the shell ignores when job
+ *  control is on.  Starts the launcher zygote for the ZYGOTE engine.
+ */
+static void
+initlaunch(void)
+{
+	sigset_t empty, defaults;
+
+	sigemptyset(&empty);
+	defaults = shell_sigs;
+	sigaddset(&defaults, SIGTTIN);
+	sigaddset(&defaults, SIGTTOU);
+	if (posix_spawnattr_init(&spawnattr) != 0 ||
+	    posix_spawnattr_setflags(&spawnattr, POSIX_SPAWN_SETPGROUP |
+	    POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF) != 0 ||
+	    posix_spawnattr_setpgroup(&spawnattr, 0) != 0 ||
+	    posix_spawnattr_setsigmask(&spawnattr, &empty) != 0 ||
+	    posix_spawnattr_setsigdefault(&spawnattr, &defaults) != 0)
+		app_error("posix_spawnattr error");
+	if (engine == ZYGOTE)
+		startzygote();
+}
+
+/*
+ * launch
+ *
+ * Requires:
+ *  "path" is the executable to run and "argv" is its NULL-terminated
+ *  argument vector.
+ *
+ * Effects:
+ *  Starts a child process executing "path" in a new process group with
+ *  the selected engine and returns its PID.  A utility that the shell
+ *  implements itself is run in a forked child without exec.  Returns 0
+ *  if the command could not be started; the error has then already been
+ *  reported.
+ */
+static pid_t
+launch(const char *path, char **argv)
+{
+	FastcmdP fast = getfastcmd(path, argv);
+	pid_t pid;
+
+	/* Print the shell's output first, and don't let a forked child
+	 * repeat it.
+	 */
+	fflush(stdout);
+	if (fast == NULL && engine == SPAWN &&
+	    (pid = launch_spawn(path, argv)) != -1)
+		return (pid);
+	if (fast == NULL && engine == ZYGOTE &&
+	    (pid = launch_zygote(path, argv)) != -1)
+		return (pid);
+	return (launch_fork(path, argv, fast));
+}
+
+/*
+ * launch_fork
+ *
+ * Requires:
+ *  "path" is the executable to run and "argv" is its NULL-terminated
+ *  argument vector.
+ *
+ * Effects:
+ *  Forks a child process that sets its group id, takes the terminal if
+ *  "childfg" is true, restores the job control signals, unblocks the
+ *  signals the shell reads from its signalfd, redirects the descriptors
+ *  given in "childfds", and executes "path", or runs "fast" and exits if
+ *  it is not NULL.  Returns the child's PID.  A child that cannot execute
+ *  "path" reports the error and exits.  When tracing, waits for the child
+ *  to execute "path" or fail to, learning which from a close-on-exec
+ *  pipe.
+ */
+static pid_t
+launch_fork(const char *path, char **argv, FastcmdP fast)
+{
+	int errpipe[2] = { -1, -1 };
+	int error;
+	ssize_t nread;
+	pid_t pid;
+
+	if (tracefd != -1 && fast == NULL && pipe2(errpipe, O_CLOEXEC) == -1)
+		errpipe[0] = errpipe[1] = -1;
+	if ((pid = fork()) == 0) {
+		tracefd = -1;   /* Only the shell writes the trace. */
+		setpgid(0, 0);
+		if (childfg)
+			tcsetpgrp(ttyfd, getpid());
+		signal(SIGTTIN, SIG_DFL);
+		signal(SIGTTOU, SIG_DFL);
+		if (sigprocmask(SIG_UNBLOCK, &shell_sigs, NULL) == -1)
+			unix_error("Problem unblocking signals!");
+		for (pid = 0; pid < 3; pid++)
+			if (childfds[pid] != -1 && dup2(childfds[pid], pid) ==
+			    -1)
+				unix_error("dup2 error");
+		if (fast != NULL) {
+			pid = fast->run(argv);
+			fflush(stdout);
+			_exit(pid);
+		}
+		if (execve(path, argv, envp) == -1) {
+			error = errno;
+			if (errpipe[1] != -1)
+				write(errpipe[1], &error, sizeof(error));
+			printf("%s: Command not found\n", argv[0]);
+			exit(0);
+		}
+	}
+	if (pid == -1)
+		unix_error("fork error");
+	TRACE(EV_FORK, pid, 0, 0);
+
+	/* Either the parent or the child may run first, so both put the
+	 * child in its group, which must exist before the job is signalled,
+	 * and give that group the terminal.
+	 */
+	setpgid(pid, pid);
+	if (childfg)
+		tcsetpgrp(ttyfd, pid);
+	if (errpipe[0] != -1) {
+		close(errpipe[1]);
+		while ((nread = read(errpipe[0], &error, sizeof(error))) ==
+		    -1 && errno == EINTR)
+			;
+		TRACE(nread > 0 ? EV_EXEC_FAIL : EV_EXEC_OK, pid, 0,
+		    nread > 0 ? error : 0);
+		close(errpipe[0]);
+	}
+	return (pid);
+}
+
+/*
+ * launch_spawn
+ *
+ * Requires:
+ *  initlaunch has been called.  "path" is the executable to run and
+ *  "argv" is its NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Starts "path" with posix_spawn, which does not copy the shell's page
+ *  tables, redirecting the descriptors given in "childfds" and giving
+ *  the child the terminal if "childfg" is true, and returns the child's
+ *  PID.  Returns 0 after reporting the error if "path" could not be
+ *  executed, or -1 if posix_spawn failed for another reason and the
+ *  caller should fall back to fork.
+ */
+static pid_t
+launch_spawn(const char *path, char **argv)
+{
+	posix_spawn_file_actions_t actions;
+	bool redirect = false;
+	pid_t pid;
+	int error, fd;
+
+	if (childfds[0] != -1 || childfds[1] != -1 || childfds[2] != -1 ||
+	    childfg) {
+		redirect = true;
+		if (posix_spawn_file_actions_init(&actions) != 0)
+			return (-1);
+#if __GLIBC_PREREQ(2, 35)
+		if (childfg && posix_spawn_file_actions_addtcsetpgrp_np(
+		    &actions, ttyfd) != 0) {
+			posix_spawn_file_actions_destroy(&actions);
+			return (-1);
+		}
+#else
+		/* Only fork can hand the child the terminal. */
+		if (childfg) {
+			posix_spawn_file_actions_destroy(&actions);
+			return (-1);
+		}
+#endif
+		for (fd = 0; fd < 3; fd++)
+			if (childfds[fd] != -1 &&
+			    posix_spawn_file_actions_adddup2(&actions,
+			    childfds[fd], fd) != 0) {
+				posix_spawn_file_actions_destroy(&actions);
+				return (-1);
+			}
+	}
+	error = posix_spawn(&pid, path, redirect ? &actions : NULL,
+	    &spawnattr, argv, envp);
+	if (redirect)
+		posix_spawn_file_actions_destroy(&actions);
+	switch (error) {
+	case 0:
+		TRACE(EV_FORK, pid, 0, 0);
+		TRACE(EV_EXEC_OK, pid, 0, 0);
+		return (pid);
+	case ENOENT:
+	case EACCES:
+	case ENOEXEC:
+	case ENOTDIR:
+	case ELOOP:
+	case ENAMETOOLONG:
+		TRACE(EV_EXEC_FAIL, 0, 0, error);
+
+		/* With -k, the message belongs in the job's output. */
+		if (childfds[1] != -1)
+			dprintf(childfds[1], "%s: Command not found\n",
+			    argv[0]);
+		else
+			printf("%s: Command not found\n", argv[0]);
+		return (0);
+	default:
+		if (verbose)
+			printf("posix_spawn: %s, using fork\n",
+			    strerror(error));
+		return (-1);
+	}
+}
+
+/*
+ * startzygote
+ *
+ * Requires:
+ *  The shell's signals are blocked, and job control, if any, is on.
+ *
+ * Effects:
+ *  Forks the launcher zygote while the shell is still small, connected
+ *  to the shell by a socket pair, and stores the shell's end of it in
+ *  "zygotefd".  If the zygote cannot be started, FORK is used instead.
+ */
+static void
+startzygote(void)
+{
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+		engine = FORK;
+		return;
+	}
+	fflush(stdout);
+	if ((pid = fork()) == 0) {
+		close(sv[0]);
+		zygote(sv[1]);
+	}
+	close(sv[1]);
+	if (pid == -1) {
+		close(sv[0]);
+		engine = FORK;
+		return;
+	}
+	zygotefd = sv[0];
+}
+
+/*
+ * zygote
+ *
+ * Requires:
+ *  "sock" is the zygote's end of the socket pair, and the shell's
+ *  signals are blocked.
+ *
+ * Effects:
+ *  Serves launch requests until the shell closes its end, and then
+ *  exits.  Each request carries the child's signal mask, whether it
+ *  takes the terminal, the path to execute, its arguments and its
+ *  environment, with its descriptors 0 to 2 attached.  The child is
+ *  cloned with CLONE_PARENT, so that it is the shell's child and the
+ *  shell reaps it as usual; it puts itself in a new process group and
+ *  executes the path, or reports the error and exits.  The reply is the
+ *  child's PID, or -1 if it could not be cloned.
+ */
+static void
+zygote(int sock)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	struct ZygoteRequest *req;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	char *buf = NULL, **vec = NULL, *str;
+	size_t bufsize = 0, vecsize = 0, i;
+	ssize_t len;
+	pid_t pid;
+	int fds[3], devnull;
+
+	/* Hold none of the shell's descriptors open. */
+	tracefd = -1;
+	close(sigfd);
+	if ((devnull = open("/dev/null", O_RDWR)) != -1) {
+		for (i = 0; i < 3; i++)
+			dup2(devnull, i);
+		if (devnull > 2)
+			close(devnull);
+	}
+
+	while ((len = recv(sock, NULL, 0, MSG_PEEK | MSG_TRUNC)) > 0) {
+		if ((size_t)len > bufsize) {
+			free(buf);
+			bufsize = len;
+			if ((buf = malloc(bufsize)) == NULL)
+				_exit(1);
+		}
+		iov.iov_base = buf;
+		iov.iov_len = bufsize;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		if ((len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) <= 0)
+			break;
+		req = (struct ZygoteRequest *)buf;
+		if ((cmsg = CMSG_FIRSTHDR(&msg)) == NULL ||
+		    cmsg->cmsg_type != SCM_RIGHTS ||
+		    cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) ||
+		    (size_t)len < sizeof(*req))
+			_exit(1);
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+		/* Point the argument and environment vectors into the
+		 * request, each string after the path in turn.
+		 */
+		if (req->argc + req->envc + 2 > vecsize) {
+			free(vec);
+			vecsize = req->argc + req->envc + 2;
+			if ((vec = malloc(vecsize * sizeof(char *))) == NULL)
+				_exit(1);
+		}
+		str = buf + sizeof(*req);
+		str += strlen(str) + 1;
+		for (i = 0; i < req->argc + req->envc + 1; i++) {
+			if (i == req->argc)
+				vec[i] = NULL;
+			else {
+				vec[i] = str;
+				str += strlen(str) + 1;
+			}
+		}
+		vec[i] = NULL;
+
+		pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL,
+		    NULL, NULL);
+		if (pid == 0) {
+			setpgid(0, 0);
+			if (req->fg)
+				tcsetpgrp(ttyfd, getpid());
+			signal(SIGTTIN, SIG_DFL);
+			signal(SIGTTOU, SIG_DFL);
+			for (i = 0; i < 3; i++)
+				dup2(fds[i], i);
+			sigprocmask(SIG_SETMASK, &req->mask, NULL);
+			execve(buf + sizeof(*req), vec, &vec[req->argc + 1]);
+			printf("%s: Command not found\n", vec[0]);
+			exit(0);
+		}
+		for (i = 0; i < 3; i++)
+			close(fds[i]);
+		if (send(sock, &pid, sizeof(pid), MSG_NOSIGNAL) == -1)
+			break;
+	}
+	_exit(0);
+}
+
+/*
+ * launch_zygote
+ *
+ * Requires:
+ *  "path" is the executable to run and "argv" is its NULL-terminated
+ *  argument vector.
+ *
+ * Effects:
+ *  Asks the launcher zygote to start "path" with "envp" as its
+ *  environment, an empty signal mask and the descriptors given in
+ *  "childfds", giving the child the terminal if "childfg" is true.
+ *  Like fork, the child reports its own failure to execute "path".
+ *  Returns the child's PID, or -1 if the zygote could not start it and
+ *  the caller should fall back to fork.  If the zygote has gone away,
+ *  stops using it.
+ */
+static pid_t
+launch_zygote(const char *path, char **argv)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} control;
+	struct ZygoteRequest req;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov[2];
+	size_t len, n;
+	ssize_t sent;
+	char **str;
+	pid_t pid;
+	int fd;
+
+	if (zygotefd == -1)
+		return (-1);
+	sigemptyset(&req.mask);
+	req.fg = childfg;
+	req.argc = 0;
+	req.envc = nenv;
+	len = sizeof(req) + strlen(path) + 1;
+	for (str = argv; *str != NULL; str++, req.argc++)
+		len += strlen(*str) + 1;
+
+	/* Copy the request into one message, followed by the environment,
+	 * which is only copied when it changes.
+	 */
+	if (len > zygotesize) {
+		free(zygotebuf);
+		zygotesize = len > 2 * zygotesize ? len : 2 * zygotesize;
+		if ((zygotebuf = malloc(zygotesize)) == NULL)
+			unix_error("launch_zygote: malloc error");
+	}
+	memcpy(zygotebuf, &req, sizeof(req));
+	len = sizeof(req);
+	n = strlen(path) + 1;
+	memcpy(&zygotebuf[len], path, n);
+	len += n;
+	for (str = argv; *str != NULL; str++) {
+		n = strlen(*str) + 1;
+		memcpy(&zygotebuf[len], *str, n);
+		len += n;
+	}
+
+	iov[0].iov_base = zygotebuf;
+	iov[0].iov_len = len;
+	iov[1].iov_base = (void *)getenvblock(&iov[1].iov_len);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+	for (fd = 0; fd < 3; fd++)
+		((int *)CMSG_DATA(cmsg))[fd] = childfds[fd] != -1 ?
+		    childfds[fd] : fd;
+
+	if ((sent = sendmsg(zygotefd, &msg, MSG_NOSIGNAL)) == -1 &&
+	    errno == EMSGSIZE)
+		return (-1);
+	if (sent == -1 || recv(zygotefd, &pid, sizeof(pid), 0) !=
+	    sizeof(pid)) {
+		if (verbose)
+			printf("launch_zygote: zygote has exited, using "
+			    "fork\n");
+		close(zygotefd);
+		zygotefd = -1;
+		return (-1);
+	}
+	if (pid == -1)
+		return (-1);
+	TRACE(EV_FORK, pid, 0, 0);
+
+	/* As with fork, the child may not have run yet. */
+	setpgid(pid, pid);
+	if (childfg)
+		tcsetpgrp(ttyfd, pid);
+	return (pid);
+}
+
+/*
+ * mustqueue
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Returns true if a new job must wait: -j was given and either jobs are
+ *  already queued or "maxrunning" jobs are running.  Stopped jobs do not
+ *  count against the limit.
+ */
+static bool
+mustqueue(void)
+{
+
+	return (maxrunning > 0 && (jobs.queued != NULL ||
+	    jobs.nstate[FG] + jobs.nstate[BG] >= maxrunning));
+}
+
+/*
+ * startjob
+ *
+ * Requires:
+ *  "job" has not been started, and "path" is the executable that
+ *  "argv" runs.
+ *
+ * Effects:
+ *  Starts a child process running "argv" for "job" and puts the job in
+ *  "state".  If the job's output is buffered, the child's stdout and
+ *  stderr go to a new memfd.  Returns true if the child was started.
+ *  Otherwise, deletes the job and returns false; the error has then
+ *  already been reported.
+ */
+static bool
+startjob(JobP job, const char *path, char **argv, int state)
+{
+	struct Output *output;
+	struct timespec now;
+	pid_t pid;
+
+	/* Send buffered output to a memfd of its own. */
+	if (job->out >= 0) {
+		output = &outq.slots[job->out & (outq.size - 1)];
+		if ((output->fd = memfd_create("tsh-output", MFD_CLOEXEC)) ==
+		    -1)
+			unix_error("memfd_create error");
+		childfds[1] = childfds[2] = output->fd;
+	}
+
+	/* SIGCHLD stays blocked in the parent, so the job cannot be
+	 * reaped before it is indexed by its PID.  The start time is taken
+	 * first, since the child may run to completion before fork returns.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	job->start = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	childfg = state == FG && ttyfd != -1;
+	pid = launch(path, argv);
+	childfds[1] = childfds[2] = -1;
+	childfg = false;
+	if (pid == 0) {
+		nfailed++;
+		removejob(&jobs, job);
+		return (false);
+	}
+	job->pid = pid;
+	job->pidfd = pidfd_open(pid, 0);
+	indexjob(jobs.pidindex, jobs.indexsize, job, true);
+	setjobstate(&jobs, job, state);
+	return (true);
+}
+
+/*
+ * startqueued
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Starts queued jobs, oldest first, in the background while fewer than
+ *  "maxrunning" jobs are running, printing each as it starts.  The
+ *  command line is parsed and resolved again when the job starts,
+ *  without the "time" keyword of a timed job.
+ */
+static void
+startqueued(void)
+{
+	struct ArenaMark mark;
+	const char *path;
+	char **argv;
+	JobP job;
+
+	while ((job = jobs.queued) != NULL &&
+	    jobs.nstate[FG] + jobs.nstate[BG] < maxrunning) {
+		setjobstate(&jobs, job, UNDEF);
+		mark = arena_mark(&cmdarena);
+		parseline(job->cmdline, strlen(job->cmdline), &cmdarena,
+		    &argv);
+
+		/* eval dropped the "time" keyword of a timed job. */
+		if (job->timed)
+			argv++;
+		if ((path = findcmd(argv[0])) == NULL) {
+			notfound(argv[0], job->out);
+			nfailed++;
+			removejob(&jobs, job);
+		} else if (startjob(job, path, argv, BG) && !batch)
+			printf("[%d] (%d) %s", job->jid, job->pid,
+			    job->cmdline);
+		arena_release(&cmdarena, mark);
+	}
+}
+
+/*
+ * newoutput
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Adds a slot for a batch command's output to the end of "outq",
+ *  growing it if it is full, and returns its sequence number.
+ */
+static size_t
+newoutput(void)
+{
+	struct Output *slots;
+	size_t seq, size;
+
+	if (outq.tail - outq.head == outq.size) {
+		size = outq.size > 0 ? 2 * outq.size : JOBSLAB;
+		if ((slots = malloc(size * sizeof(*slots))) == NULL)
+			unix_error("newoutput: malloc error");
+		for (seq = outq.head; seq != outq.tail; seq++)
+			slots[seq & (size - 1)] =
+			    outq.slots[seq & (outq.size - 1)];
+		free(outq.slots);
+		outq.slots = slots;
+		outq.size = size;
+	}
+	seq = outq.tail++;
+	outq.slots[seq & (outq.size - 1)].fd = -1;
+	outq.slots[seq & (outq.size - 1)].done = false;
+	return (seq);
+}
+
+/*
+ * endoutput
+ *
+ * Requires:
+ *  "seq" is the sequence number of an output in "outq".
+ *
+ * Effects:
+ *  Marks the output complete and prints every complete output that no
+ *  earlier, incomplete output is holding back.
+ */
+static void
+endoutput(size_t seq)
+{
+
+	outq.slots[seq & (outq.size - 1)].done = true;
+	if (seq == outq.head)
+		flushoutput();
+}
+
+/*
+ * flushoutput
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Copies the complete outputs at the head of "outq" to stdout, in
+ *  order, and closes their memfds.
+ */
+static void
+flushoutput(void)
+{
+	struct Output *output;
+	char buf[65536];
+	ssize_t nread;
+	off_t off;
+
+	fflush(stdout);
+	while (outq.head != outq.tail &&
+	    (output = &outq.slots[outq.head & (outq.size - 1)])->done) {
+		/* The child shares the memfd's offset, so read by offset. */
+		for (off = 0; output->fd != -1 &&
+		    (nread = pread(output->fd, buf, sizeof(buf), off)) > 0;
+		    off += nread)
+			if (write(STDOUT_FILENO, buf, nread) != nread)
+				break;
+		if (output->fd != -1)
+			close(output->fd);
+		outq.head++;
+	}
+}
+
+/*
+ * notfound
+ *
+ * Requires:
+ *  "out" is -1 or the sequence number of an incomplete output in
+ *  "outq".
+ *
+ * Effects:
+ *  Reports that the command "name" was not found: in the output "out",
+ *  so that -k prints the message in script order, or on standard
+ *  output if "out" is -1.
+ */
+static void
+notfound(const char *name, int out)
+{
+	struct Output *output;
+
+	if (out < 0) {
+		printf("%s: Command not found\n", name);
+		return;
+	}
+	output = &outq.slots[out & (outq.size - 1)];
+	if (output->fd == -1 &&
+	    (output->fd = memfd_create("tsh-output", MFD_CLOEXEC)) == -1)
+		unix_error("memfd_create error");
+	dprintf(output->fd, "%s: Command not found\n", name);
+}
+
+/*
+ * This comment marks the end of the launch helper routines.
+ */
+
+/*
+ * The following helper routines are the shell's own versions of simple
+ * utilities.  With -i, a command that resolves to one of these utilities
+ * in /bin or /usr/bin runs without exec: in the shell itself if it is a
+ * foreground echo, true, false or printf, and otherwise in a forked
+ * child.  Each version produces the same output as GNU coreutils, and
+ * arguments it does not handle exactly (such as --help) are left to the
+ * real utility.
+ */
+
+static const struct Fastcmd fastcmd_table[] = {
+	{ "echo", fast_echo_usable, fast_echo, true },
+	{ "true", fast_noopts, fast_true, true },
+	{ "false", fast_noopts, fast_false, true },
+	{ "printf", fast_printf_usable, fast_printf, true },
+	{ "sleep", fast_sleep_usable, fast_sleep, false },
+};
+
+/*
+ * getfastcmd
+ *
+ * Requires:
+ *  "path" is the executable that "argv" would run.
+ *
+ * Effects:
+ *  Returns the shell's own version of the utility at "path" if -i was
+ *  given, "path" is /bin/<name> or /usr/bin/<name> for a utility in the
+ *  table, and that version can handle "argv".  Otherwise returns NULL.
+ */
+static FastcmdP
+getfastcmd(const char *path, char **argv)
+{
+	const char *name;
+	size_t i;
+
+	if (!fastcmds)
+		return (NULL);
+	if (strncmp(path, "/bin/", 5) == 0)
+		name = path + 5;
+	else if (strncmp(path, "/usr/bin/", 9) == 0)
+		name = path + 9;
+	else
+		return (NULL);
+	for (i = 0; i < sizeof(fastcmd_table) / sizeof(fastcmd_table[0]);
+	    i++)
+		if (strcmp(name, fastcmd_table[i].name) == 0)
+			return (fastcmd_table[i].usable(argv) ?
+			    &fastcmd_table[i] : NULL);
+	return (NULL);
+}
+
+/*
+ * fast_noopts
+ *
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Returns false if the only argument is --help or --version, which the
+ *  coreutils utilities answer, and true otherwise.
+ */
+static bool
+fast_noopts(char **argv)
+{
+
+	return (argv[1] == NULL || argv[2] != NULL ||
+	    (strcmp(argv[1], "--help") != 0 &&
+	    strcmp(argv[1], "--version") != 0));
+}
+
+/*
+ * fast_echo_usable
+ *
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Returns true if fast_echo behaves like coreutils echo for "argv".
+ */
+static bool
+fast_echo_usable(char **argv)
+{
+
+	return (fast_noopts(argv) && getenv("POSIXLY_CORRECT") == NULL);
+}
+
+/*
+ * fast_echo
+ *
+ * Requires:
+ *  fast_echo_usable(argv) is true.
+ *
+ * Effects:
+ *  Prints the arguments separated by spaces and followed by a newline,
+ *  accepting the -n, -e and -E options and, with -e, backslash escapes
+ *  as coreutils echo does.  Returns 0.
+ */
+static int
+fast_echo(char **argv)
+{
+	const char *arg, *opt;
+	bool newline = true, escapes = false;
+	int c;
+
+	/* Leading arguments made only of n, e and E are options. */
+	for (argv++; *argv != NULL && (*argv)[0] == '-'; argv++) {
+		for (opt = &(*argv)[1]; *opt == 'n' || *opt == 'e' ||
+		    *opt == 'E'; opt++)
+			;
+		if (*opt != '\0' || opt == &(*argv)[1])
+			break;
+		for (opt = &(*argv)[1]; *opt != '\0'; opt++) {
+			if (*opt == 'n')
+				newline = false;
+			else
+				escapes = *opt == 'e';
+		}
+	}
+
+	for (; *argv != NULL; argv++) {
+		for (arg = *argv; escapes && *arg != '\0'; arg++) {
+			if (*arg != '\\' || arg[1] == '\0') {
+				putchar(*arg);
+				continue;
+			}
+			switch (c = *++arg) {
+			case 'a': c = '\a'; break;
+			case 'b': c = '\b'; break;
+			case 'c': return (0);
+			case 'e': c = '\033'; break;
+			case 'f': c = '\f'; break;
+			case 'n': c = '\n'; break;
+			case 'r': c = '\r'; break;
+			case 't': c = '\t'; break;
+			case 'v': c = '\v'; break;
+			case '\\': break;
+			case 'x':
+				if (!isxdigit((unsigned char)arg[1])) {
+					putchar('\\');
+					break;
+				}
+				c = hexvalue(*++arg);
+				if (isxdigit((unsigned char)arg[1]))
+					c = 16 * c + hexvalue(*++arg);
+				break;
+			case '0':
+				c = 0;
+				if (arg[1] < '0' || arg[1] > '7')
+					break;
+				c = *++arg;
+				/* FALLTHROUGH */
+			case '1': case '2': case '3':
+			case '4': case '5': case '6': case '7':
+				c -= '0';
+				if (arg[1] >= '0' && arg[1] <= '7')
+					c = 8 * c + *++arg - '0';
+				if (arg[1] >= '0' && arg[1] <= '7')
+					c = 8 * c + *++arg - '0';
+				break;
+			default:
+				putchar('\\');
+				break;
+			}
+			putchar(c);
+		}
+		if (!escapes)
+			fputs(*argv, stdout);
+		if (argv[1] != NULL)
+			putchar(' ');
+	}
+	if (newline)
+		putchar('\n');
+	return (0);
+}
+
+/*
+ * hexvalue
+ *
+ * Requires:
+ *  "c" is a hexadecimal digit.
+ *
+ * Effects:
+ *  Returns the value of the digit "c".
+ */
+static int
+hexvalue(int c)
+{
+
+	return (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+}
+
+/*
+ * fast_true
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Returns 0.
+ */
+static int
+fast_true(char **argv)
+{
+
+	(void)argv;
+	return (0);
+}
+
+/*
+ * fast_false
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Returns 1.
+ */
+static int
+fast_false(char **argv)
+{
+
+	(void)argv;
+	return (1);
+}
+
+/*
+ * fast_printf_usable
+ *
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Returns true if fast_printf behaves like coreutils printf for "argv":
+ *  the format uses only the %s, %d, %i, %c and %% conversions, without
+ *  flags, widths or precisions, and the common backslash escapes, and
+ *  every numeric argument converts without error.
+ */
+static bool
+fast_printf_usable(char **argv)
+{
+
+	if (argv[1] == NULL || argv[1][0] == '-')
+		return (false);
+	return (printf_args(argv, false));
+}
+
+/*
+ * fast_printf
+ *
+ * Requires:
+ *  fast_printf_usable(argv) is true.
+ *
+ * Effects:
+ *  Prints the arguments under the control of the format as coreutils
+ *  printf does, reusing the format until the arguments are consumed.
+ *  Returns 0.
+ */
+static int
+fast_printf(char **argv)
+{
+
+	printf_args(argv, true);
+	return (0);
+}
+
+/*
+ * printf_args
+ *
+ * Requires:
+ *  argv[1] is not NULL.
+ *
+ * Effects:
+ *  Applies the format argv[1] to the remaining arguments, printing the
+ *  result if "output" is true.  Returns false if the format or the
+ *  arguments need anything that printf_format does not implement.
+ */
+static bool
+printf_args(char **argv, bool output)
+{
+	char **args = &argv[2];
+	bool stop = false;
+	int used;
+
+	do {
+		if ((used = printf_format(argv[1], args, output, &stop)) ==
+		    -1)
+			return (false);
+		args += used;
+	} while (!stop && used > 0 && *args != NULL);
+
+	/* Coreutils warns about arguments that the format never uses. */
+	return (stop || *args == NULL);
+}
+
+/*
+ * printf_format
+ *
+ * Requires:
+ *  "args" is a NULL-terminated array.
+ *
+ * Effects:
+ *  Applies "format" once to "args", printing the result if "output" is
+ *  true, and returns the number of arguments consumed.  Missing arguments
+ *  are treated as empty strings.  Sets "*stopp" and returns at once if
+ *  the format contains \c.  Returns -1 if the format or an argument needs
+ *  anything this routine does not implement.
+ */
+static int
+printf_format(const char *format, char **args, bool output, bool *stopp)
+{
+	const char *arg, *end;
+	intmax_t value;
+	int c, i, used = 0;
+
+	for (; *format != '\0'; format++) {
+		if (*format == '%') {
+			c = *++format;
+			if (c == '%') {
+				if (output)
+					putchar('%');
+				continue;
+			}
+			if (c != 's' && c != 'd' && c != 'i' && c != 'c')
+				return (-1);
+			arg = "";
+			if (args[used] != NULL)
+				arg = args[used++];
+			if (c == 's') {
+				if (output)
+					fputs(arg, stdout);
+			} else if (c == 'c') {
+				if (output)
+					putchar(arg[0]);
+			} else {
+				/* Character constants like 'a are left to
+				 * coreutils, as are conversion errors.
+				 */
+				if (arg[0] == '\'' || arg[0] == '"')
+					return (-1);
+				errno = 0;
+				value = strtoimax(arg, (char **)&end, 0);
+				if (errno != 0 || *end != '\0')
+					return (-1);
+				if (output)
+					printf("%jd", value);
+			}
+			continue;
+		}
+		if (*format != '\\') {
+			if (output)
+				putchar(*format);
+			continue;
+		}
+		switch (c = *++format) {
+		case 'a': c = '\a'; break;
+		case 'b': c = '\b'; break;
+		case 'c': *stopp = true; return (used);
+		case 'e': c = '\033'; break;
+		case 'f': c = '\f'; break;
+		case 'n': c = '\n'; break;
+		case 'r': c = '\r'; break;
+		case 't': c = '\t'; break;
+		case 'v': c = '\v'; break;
+		case '"': case '\\': break;
+		case 'x':
+			if (!isxdigit((unsigned char)format[1]))
+				return (-1);
+			c = hexvalue(*++format);
+			if (isxdigit((unsigned char)format[1]))
+				c = 16 * c + hexvalue(*++format);
+			break;
+		case '0': case '1': case '2': case '3':
+		case '4': case '5': case '6': case '7':
+			c -= '0';
+			for (i = 1; i < 3 && format[1] >= '0' &&
+			    format[1] <= '7'; i++)
+				c = 8 * c + *++format - '0';
+			break;
+		default:
+			return (-1);
+		}
+		if (output)
+			putchar(c);
+	}
+	return (used);
+}
+
+/*
+ * fast_sleep_usable
+ *
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Returns true if every argument is a valid coreutils sleep interval.
+ */
+static bool
+fast_sleep_usable(char **argv)
+{
+	double seconds;
+
+	return (sleep_seconds(argv, &seconds));
+}
+
+/*
+ * fast_sleep
+ *
+ * Requires:
+ *  fast_sleep_usable(argv) is true.
+ *
+ * Effects:
+ *  Sleeps for the sum of the intervals.  Returns 0.
+ */
+static int
+fast_sleep(char **argv)
+{
+	struct timespec ts;
+	double seconds;
+
+	sleep_seconds(argv, &seconds);
+	while (seconds > 0) {
+		/* Sleep in pieces that fit in a time_t. */
+		ts.tv_sec = seconds > 1e9 ? 1000000000 : (time_t)seconds;
+		ts.tv_nsec = (seconds - ts.tv_sec) * 1e9;
+		if (ts.tv_nsec > 999999999)
+			ts.tv_nsec = 999999999;
+		seconds -= ts.tv_sec + ts.tv_nsec / 1e9;
+		while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+			;
+	}
+	return (0);
+}
+
+/*
+ * sleep_seconds
+ *
+ * Requires:
+ *  "argv" is a NULL-terminated argument vector.
+ *
+ * Effects:
+ *  Sets "*secondsp" to the sum of the intervals in argv[1] onward, each
+ *  a non-negative number optionally followed by s, m, h or d, and returns
+ *  true.  Returns false if there are no intervals or one is invalid.
+ */
+static bool
+sleep_seconds(char **argv, double *secondsp)
+{
+	char *end;
+	double value;
+
+	*secondsp = 0;
+	if (argv[1] == NULL)
+		return (false);
+	for (argv++; *argv != NULL; argv++) {
+		if ((*argv)[0] == '-')
+			return (false);
+		value = strtod(*argv, &end);
+		if (end == *argv || !(value >= 0))
+			return (false);
+		switch (*end) {
+		case '\0': case 's': break;
+		case 'm': value *= 60; break;
+		case 'h': value *= 60 * 60; break;
+		case 'd': value *= 24 * 60 * 60; break;
+		default: return (false);
+		}
+		if (*end != '\0' && end[1] != '\0')
+			return (false);
+		*secondsp += value;
+	}
+	return (true);
+}
+
+
+/*
+ * The following helper routines manage the search path cache.
+ */
+
+/*
+ * hashname
+ *
+ * Requires:
+ *  "name" is a properly terminated string.
+ *
+ * Effects:
+ *  Returns the 64-bit FNV-1a hash of "name".
+ */
+static unsigned long
+hashname(const char *name)
+{
+
+	return (hashbytes(name, strlen(name)));
+}
+
+/*
+ * hashbytes
+ *
+ * Requires:
+ *  "buf" holds "len" bytes.
+ *
+ * Effects:
+ *  Returns the 64-bit FNV-1a hash of the bytes.
+ */
+static unsigned long
+hashbytes(const char *buf, size_t len)
+{
+	unsigned long hash = 14695981039346656037UL;
+
+	while (len-- > 0) {
+		hash ^= (unsigned char)*buf++;
+		hash *= 1099511628211UL;
+	}
+	return (hash);
+}
+
+/*
+ * statpath
+ *
+ * Requires:
+ *  "pathdirs" and "pathmtimes" hold "npathdirs" entries.
+ *
+ * Effects:
+ *  Records the current modification time of each directory on the
+ *  search path.  Returns true if any of them was modified, created or
+ *  removed since it was last recorded.
+ */
+static bool
+statpath(void)
+{
+	struct stat sb;
+	struct timespec mtime;
+	bool stale = false;
+	int i;
+
+	for (i = 0; i < npathdirs; i++) {
+		if (stat(pathdirs[i], &sb) == 0)
+			mtime = sb.st_mtim;
+		else
+			mtime.tv_sec = mtime.tv_nsec = -1;
+		if (mtime.tv_sec != pathmtimes[i].tv_sec ||
+		    mtime.tv_nsec != pathmtimes[i].tv_nsec) {
+			pathmtimes[i] = mtime;
+			stale = true;
+		}
+	}
+	return (stale);
+}
+
+/*
+ * checkpath
+ *
+ * Requires:
+ *  initpath has been called.
+ *
+ * Effects:
+ *  Empties the search path cache if any directory on the search path
+ *  has changed since it was last checked.  PATH itself only changes
+ *  through export and unset, which rebuild the search path at once.
+ */
+static void
+checkpath(void)
+{
+
+	if (statpath())
+		clearpathcache();
+}
+
+/*
+ * getpathentry
+ *
+ * Requires:
+ *  "name" is a properly terminated string.
+ *
+ * Effects:
+ *  Returns the cache entry for "name".  If there is none, returns NULL
+ *  or, if "create" is true, searches the directories on the search path
+ *  and returns a new entry recording the first executable found there
+ *  or, failing that, the miss.
+ */
+static PathEntryP
+getpathentry(const char *name, bool create)
+{
+	PathEntryP entry, next, *oldtab;
+	struct stat sb;
+	unsigned long hash = hashname(name);
+	size_t i, oldsize;
+	char *path;
+	int dir;
+
+	if (pathtabsize > 0) {
+		for (entry = pathtab[hash & (pathtabsize - 1)]; entry != NULL;
+		    entry = entry->next)
+			if (strcmp(entry->name, name) == 0)
+				return (entry);
+	}
+	if (!create)
+		return (NULL);
+
+	/* Double the number of buckets once they average one entry. */
+	if (npathentries >= pathtabsize) {
+		oldtab = pathtab;
+		oldsize = pathtabsize;
+		pathtabsize = oldsize > 0 ? oldsize * 2 : 64;
+		if ((pathtab = calloc(pathtabsize, sizeof(PathEntryP))) ==
+		    NULL)
+			unix_error("getpathentry: calloc error");
+		for (i = 0; i < oldsize; i++) {
+			for (entry = oldtab[i]; entry != NULL; entry = next) {
+				next = entry->next;
+				entry->next = pathtab[hashname(entry->name) &
+				    (pathtabsize - 1)];
+				pathtab[hashname(entry->name) &
+				    (pathtabsize - 1)] = entry;
+			}
+		}
+		free(oldtab);
+	}
+
+	if ((entry = malloc(sizeof(struct PathEntry) + strlen(name) + 1)) ==
+	    NULL)
+		unix_error("getpathentry: malloc error");
+	strcpy(entry->name, name);
+	entry->path = NULL;
+	entry->hits = 0;
+	for (dir = 0; dir < npathdirs && entry->path == NULL; dir++) {
+		if ((path = malloc(strlen(pathdirs[dir]) + strlen(name) + 2)) ==
+		    NULL)
+			unix_error("getpathentry: malloc error");
+		sprintf(path, "%s/%s", pathdirs[dir], name);
+		if (stat(path, &sb) == 0 && S_ISREG(sb.st_mode) &&
+		    access(path, X_OK) == 0)
+			entry->path = path;
+		else
+			free(path);
+	}
+	entry->next = pathtab[hash & (pathtabsize - 1)];
+	pathtab[hash & (pathtabsize - 1)] = entry;
+	npathentries++;
+	return (entry);
+}
+
+/*
+ * deletepathentry
+ *
+ * Requires:
+ *  "name" is a properly terminated string.
+ *
+ * Effects:
+ *  Removes the cache entry for "name", if there is one.
+ */
+static void
+deletepathentry(const char *name)
+{
+	PathEntryP entry, *prevp;
+
+	if (pathtabsize == 0)
+		return;
+	for (prevp = &pathtab[hashname(name) & (pathtabsize - 1)];
+	    (entry = *prevp) != NULL; prevp = &entry->next) {
+		if (strcmp(entry->name, name) == 0) {
+			*prevp = entry->next;
+			free(entry->path);
+			free(entry);
+			npathentries--;
+			return;
+		}
+	}
+}
+
+/*
+ * clearpathcache
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Removes every entry from the search path cache.
+ */
+static void
+clearpathcache(void)
+{
+	PathEntryP entry, next;
+	size_t i;
+
+	for (i = 0; i < pathtabsize; i++) {
+		for (entry = pathtab[i]; entry != NULL; entry = next) {
+			next = entry->next;
+			free(entry->path);
+			free(entry);
+		}
+		pathtab[i] = NULL;
+	}
+	npathentries = 0;
+}
+
+/*
+ * findcmd
+ *
+ * Requires:
+ *  "name" is a properly terminated string.
+ *
+ * Effects:
+ *  Returns the path to execute for the command "name", or NULL if it is
+ *  not on the search path.  A name that contains a '/' is returned
+ *  unchanged.  Otherwise the search path cache is revalidated and used,
+ *  searching the directories only on a cache miss.
+ */
+static const char *
+findcmd(const char *name)
+{
+	PathEntryP entry;
+
+	if (strchr(name, '/') != NULL)
+		return (name);
+	checkpath();
+	entry = getpathentry(name, true);
+	entry->hits++;
+	return (entry->path);
 }
 
-/* 
- * sigint_handler - The kernel sends a SIGINT to the shell whenever the
- *  user types ctrl-c at the keyboard.  Catch it and send it along
- *  to the foreground job.  
+/*
+ * This comment marks the end of the search path cache helper routines.
+ */
+
+/*
+ * Environment helper routines follow.
+ */
+
+/*
+ * initenv
  *
  * Requires:
- *  Signal number
+ *  Nothing.
  *
  * Effects:
- *  Catches an interrupt signal and sends it to the foreground job
+ *  Loads the variables of the environment that the shell was started
+ *  with into the environment table and makes "envp" the environment
+ *  from then on.  Strings without a '=' are dropped, and of several
+ *  with the same name the first is kept, as getenv would find it.
  */
 static void
-sigint_handler(int sig) 
-{	
-	if (sig != SIGINT) {
-		if (verbose)
-			printf("Error: SIGINT not received!\n");
-	}
-	/* Ensure that there is a job running in the foreground and forward
-	 * the interrupt signal to it, otherwise don't do anything
+initenv(void)
+{
+	const char *eq;
+	char **str;
+
+	/* This walks the original array even after growenv points
+	 * "environ" at "envp".
 	 */
-	else {
-		pid_t fg_pid = fgpid(jobs);
-		if (!fg_pid) {
-			if (verbose)
-				printf("Error: No such job to STOP!\n");
-			return;
-		}
+	for (str = environ; *str != NULL; str++)
+		if ((eq = strchr(*str, '=')) != NULL &&
+		    getenvvar(*str, eq - *str) == NULL)
+			setenvvar(*str, eq - *str);
+	if (envp == NULL)
+		growenv();
+	environ = envp;
+}
 
-		JobP fgJob = getjobpid(jobs, fg_pid);
-		if (fgJob == NULL || kill(-fgJob->pid, sig) == -1)
-			unix_error("Unable to forward SIGINT!\n");
-	}
-	
-	return;
+/*
+ * getenvvar
+ *
+ * Requires:
+ *  "name" holds "len" bytes, which need not be NUL-terminated.
+ *
+ * Effects:
+ *  Returns the variable called "name", or NULL if it is not set.
+ */
+static EnvVarP
+getenvvar(const char *name, size_t len)
+{
+	EnvVarP var;
+
+	if (envtabsize == 0)
+		return (NULL);
+	for (var = envtab[hashbytes(name, len) & (envtabsize - 1)];
+	    var != NULL; var = var->next)
+		if (var->namelen == len && strncmp(var->str, name, len) == 0)
+			return (var);
+	return (NULL);
 }
 
 /*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *  the user types ctrl-z at the keyboard.  Catch it and suspend the
- *  foreground job by sending it a SIGTSTP.  
+ * setenvvar
  *
  * Requires:
- *  Signal number
+ *  "str" is a properly terminated "name=value" string whose name is
+ *  "namelen" bytes long.
  *
  * Effects:
- *  Catches a TSTP signal and sends it to the foreground job
+ *  Sets the variable to a copy of "str", replacing its string in place
+ *  in "envp" or appending it there if the variable is new.  Returns
+ *  false, changing nothing, if the variable already has that value.
  */
-static void
-sigtstp_handler(int sig) 
+static bool
+setenvvar(const char *str, size_t namelen)
 {
-	if (sig != SIGTSTP) {
-		if (verbose)
-			printf("Error: SIGTSTP not received!\n");
+	EnvVarP var, next;
+	size_t i, oldsize;
+	EnvVarP *oldtab;
+	char *copy;
+
+	if ((var = getenvvar(str, namelen)) != NULL) {
+		if (strcmp(var->str, str) == 0)
+			return (false);
+		if ((copy = strdup(str)) == NULL)
+			unix_error("setenvvar: strdup error");
+		free(var->str);
+		var->str = envp[var->slot] = copy;
+		envchanged(str, namelen);
+		return (true);
 	}
-	/* Ensure that there is a job running in the foreground and 
-	 * forward the tstp signal to it, otherwise don't do anything
-	 */
-	else {
-		pid_t fg_pid = fgpid(jobs);
-		if (!fg_pid) {
-			if (verbose)
-				printf("Error: No such job to STOP!\n");
-			return;
+
+	/* Keep the table at most half full. */
+	if (2 * (nenv + 1) > envtabsize) {
+		oldtab = envtab;
+		oldsize = envtabsize;
+		envtabsize = oldsize > 0 ? 2 * oldsize : 64;
+		if ((envtab = calloc(envtabsize, sizeof(EnvVarP))) == NULL)
+			unix_error("setenvvar: calloc error");
+		for (i = 0; i < oldsize; i++) {
+			for (var = oldtab[i]; var != NULL; var = next) {
+				next = var->next;
+				var->next = envtab[var->hash &
+				    (envtabsize - 1)];
+				envtab[var->hash & (envtabsize - 1)] = var;
+			}
 		}
+		free(oldtab);
+	}
+	if (nenv == envcap)
+		growenv();
 
-		JobP fgJob = getjobpid(jobs, fg_pid);	
-		if (fgJob == NULL || kill(-fgJob->pid, sig) == -1)
-			unix_error("Unable to forward SIGTSTP!\n"); 
+	if ((var = malloc(sizeof(struct EnvVar))) == NULL ||
+	    (var->str = strdup(str)) == NULL)
+		unix_error("setenvvar: malloc error");
+	var->namelen = namelen;
+	var->hash = hashbytes(str, namelen);
+	var->slot = nenv;
+	var->next = envtab[var->hash & (envtabsize - 1)];
+	envtab[var->hash & (envtabsize - 1)] = var;
+	envp[nenv++] = var->str;
+	envp[nenv] = NULL;
+	envchanged(str, namelen);
+	return (true);
+}
+
+/*
+ * unsetenvvar
+ *
+ * Requires:
+ *  "name" is a properly terminated string.
+ *
+ * Effects:
+ *  Removes the variable called "name", moving the last string in
+ *  "envp" into its slot.  Returns false if it was not set.
+ */
+static bool
+unsetenvvar(const char *name)
+{
+	EnvVarP var, *link;
+	size_t len = strlen(name);
+
+	if ((var = getenvvar(name, len)) == NULL)
+		return (false);
+	for (link = &envtab[var->hash & (envtabsize - 1)]; *link != var;
+	    link = &(*link)->next)
+		;
+	*link = var->next;
+	if (var->slot != --nenv) {
+		envp[var->slot] = envp[nenv];
+		getenvvar(envp[nenv], strchr(envp[nenv], '=') -
+		    envp[nenv])->slot = var->slot;
 	}
-	return;
+	envp[nenv] = NULL;
+	free(var->str);
+	free(var);
+	envchanged(name, len);
+	return (true);
 }
 
 /*
- * sigquit_handler - The driver program can gracefully terminate the
- *  child shell by sending it a SIGQUIT signal.
+ * growenv
  *
  * Requires:
- *  "signum" is SIGQUIT.
+ *  Nothing.
  *
  * Effects:
- *  Terminates the program.
+ *  Doubles the room in "envp", keeping "environ" pointing at it.
  */
 static void
-sigquit_handler(int signum)
+growenv(void)
 {
 
-	assert(signum == SIGQUIT);
-	printf("Terminating after receipt of SIGQUIT signal\n");
-	exit(1);
+	envcap = envcap > 0 ? 2 * envcap : 64;
+	if ((envp = realloc(envp, (envcap + 1) * sizeof(char *))) == NULL)
+		unix_error("growenv: realloc error");
+	envp[nenv] = NULL;
+	environ = envp;
 }
 
 /*
- * This comment marks the end of the signal handlers.
+ * envchanged
+ *
+ * Requires:
+ *  "name" holds "len" bytes, which need not be NUL-terminated.
+ *
+ * Effects:
+ *  Notes that the variable called "name" has been set or unset: the
+ *  copy of the environment sent to the zygote is out of date, and a
+ *  new PATH rebuilds the search path and empties its cache.
  */
+static void
+envchanged(const char *name, size_t len)
+{
+
+	envstale = true;
+
+	/* Before main builds the search path, there is nothing to redo. */
+	if (len == 4 && strncmp(name, "PATH", 4) == 0 && pathdirs != NULL)
+		initpath(getenv("PATH"));
+}
 
 /*
- * The following helper routines manipulate the jobs list.
+ * getenvblock
+ *
+ * Requires:
+ *  initenv has been called.
+ *
+ * Effects:
+ *  Returns the strings of "envp" laid end to end, each with its NUL,
+ *  and stores their total length in "lenp".  They are copied again only
+ *  after the environment has changed.
  */
+static const char *
+getenvblock(size_t *lenp)
+{
+	size_t i, len, n;
+
+	if (envstale) {
+		for (len = 0, i = 0; i < nenv; i++)
+			len += strlen(envp[i]) + 1;
+		if ((envblock = realloc(envblock, len + 1)) == NULL)
+			unix_error("getenvblock: realloc error");
+		for (envblocklen = 0, i = 0; i < nenv; i++) {
+			n = strlen(envp[i]) + 1;
+			memcpy(&envblock[envblocklen], envp[i], n);
+			envblocklen += n;
+		}
+		envstale = false;
+	}
+	*lenp = envblocklen;
+	return (envblock);
+}
 
 /*
- * clearjob
+ * validname
  *
  * Requires:
- *  "job" points to a job structure.
+ *  "name" holds "len" bytes.
  *
  * Effects:
- *  Clears the fields in the referenced job structure.
+ *  Returns whether "name" is a valid variable name: a letter or
+ *  underscore followed by letters, digits and underscores.
  */
-static void
-clearjob(JobP job)
+static bool
+validname(const char *name, size_t len)
 {
+	size_t i;
 
-	job->pid = 0;
-	job->jid = 0;
-	job->state = UNDEF;
-	job->cmdline[0] = '\0';
+	if (len == 0 || isdigit((unsigned char)name[0]))
+		return (false);
+	for (i = 0; i < len; i++)
+		if (!isalnum((unsigned char)name[i]) && name[i] != '_')
+			return (false);
+	return (true);
 }
 
 /*
- * initjobs
- * 
+ * This comment marks the end of the environment helper routines.
+ */
+
+/*
+ * Trace helper routines follow.
+ */
+
+/*
+ * traceopen
+ *
  * Requires:
- *  "jobs" points to an array of MAXJOBS job structures.
+ *  "file" is a properly terminated string.
  *
  * Effects:
- *  Initializes the jobs list to an empty state.
+ *  Creates the trace file "file", writes its header, allocates the event
+ *  ring, and arranges for the ring to be flushed when the shell exits.
+ *  The header is the line "tsh-trace 1", a line "<type> <name>" for each
+ *  event type, and an empty line; the events follow as struct
+ *  TraceEvent records in the host's byte order.
  */
 static void
-initjobs(JobP jobs)
+traceopen(const char *file)
 {
-	int i;
+	FILE *fp;
+	int type;
 
-	for (i = 0; i < MAXJOBS; i++)
-		clearjob(&jobs[i]);
+	if ((tracefd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+	    0666)) == -1 || (fp = fdopen(dup(tracefd), "w")) == NULL)
+		unix_error(file);
+	fprintf(fp, "tsh-trace 1\n");
+	for (type = 0; type < EV_COUNT; type++)
+		fprintf(fp, "%d %s\n", type, eventnames[type]);
+	fprintf(fp, "\n");
+	if (fclose(fp) != 0)
+		unix_error(file);
+	lseek(tracefd, 0, SEEK_END);
+	if ((traceq.events = malloc(TRACERING * sizeof(struct TraceEvent))) ==
+	    NULL)
+		unix_error("traceopen: malloc error");
+	traceq.head = traceq.tail = 0;
+	atexit(traceflush);
 }
 
 /*
- * maxjid
+ * traceevent
  *
  * Requires:
- *  "jobs" points to an array of MAXJOBS job structures.
+ *  "type" is one of the EV_* event types and tracing is on.
  *
  * Effects:
- *  Returns the largest allocated job ID.
+ *  Appends a timestamped event to the ring.  Events are written out by
+ *  traceflush before the shell blocks; only a full ring is flushed here.
  */
-static int
-maxjid(JobP jobs) 
+static void
+traceevent(int type, pid_t pid, int jid, int arg)
 {
-	int i, max = 0;
+	struct TraceEvent *event;
+	struct timespec ts;
 
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].jid > max)
-			max = jobs[i].jid;
-	return (max);
+	if (traceq.tail - traceq.head == TRACERING)
+		traceflush();
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	event = &traceq.events[traceq.tail & (TRACERING - 1)];
+	event->ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	event->type = type;
+	event->pid = pid;
+	event->jid = jid;
+	event->arg = arg;
+	traceq.tail++;
 }
 
 /*
- * addjob
+ * traceflush
  *
  * Requires:
- *  "jobs" points to an array of MAXJOBS job structures, and "cmdline" is
- *  a properly terminated string.
+ *  Nothing.
  *
- * Effects: 
- *  Adds a job to the jobs list. 
+ * Effects:
+ *  Writes the events in the ring to the trace file, in at most two
+ *  writes, and empties the ring.  Does nothing if tracing is off, as it
+ *  is in a forked child.
  */
-static int
-addjob(JobP jobs, pid_t pid, int state, const char *cmdline)
+static void
+traceflush(void)
 {
-	int i;
-    
-	if (pid < 1)
-		return (0);
-	for (i = 0; i < MAXJOBS; i++) {
-		if (jobs[i].pid == 0) {
-			jobs[i].pid = pid;
-			jobs[i].state = state;
-			jobs[i].jid = nextjid++;
-			if (nextjid > MAXJOBS)
-				nextjid = 1;
-			strcpy(jobs[i].cmdline, cmdline);
-			if (verbose) {
-				printf("Added job [%d] %d %s\n", jobs[i].jid,
-				    (int)jobs[i].pid, jobs[i].cmdline);
-			}
-			return (1);
-		}
+	struct iovec iov[2];
+	size_t head, tail;
+	ssize_t nwritten;
+
+	if (tracefd == -1 || traceq.tail == traceq.head)
+		return;
+	head = traceq.head & (TRACERING - 1);
+	tail = traceq.tail & (TRACERING - 1);
+	iov[0].iov_base = &traceq.events[head];
+	iov[1].iov_base = traceq.events;
+	if (tail > head) {
+		iov[0].iov_len = (tail - head) * sizeof(struct TraceEvent);
+		iov[1].iov_len = 0;
+	} else {
+		iov[0].iov_len = (TRACERING - head) *
+		    sizeof(struct TraceEvent);
+		iov[1].iov_len = tail * sizeof(struct TraceEvent);
 	}
-	printf("Tried to create too many jobs\n");
-	return (0);
+	while ((nwritten = writev(tracefd, iov, 2)) == -1 && errno == EINTR)
+		;
+	if (nwritten == -1) {
+		/* Stop tracing rather than fail the command. */
+		printf("trace: %s\n", strerror(errno));
+		close(tracefd);
+		tracefd = -1;
+	}
+	traceq.head = traceq.tail;
 }
 
 /*
- * deletejob 
- * 
+ * This comment marks the end of the trace helper routines.
+ */
+
+/*
+ * Other helper routines follow.
+ */
+
+/*
+ * readcmd
+ *
  * Requires:
- *  "jobs" points to an array of MAXJOBS job structures.
+ *  "lenp" points to a size_t.
  *
  * Effects:
- *  Deletes a job from the jobs list whose PID equals "pid".
+ *  Reads the next line from standard input, handling any signals that
+ *  arrive while the shell waits for input.  Returns the line, which is
+ *  NUL terminated and valid until the next call, and stores its length
+ *  in "*lenp".  The input buffer grows to hold lines of any length.  A
+ *  final line without a trailing newline is given one.  Returns NULL at
+ *  end of file.
  */
-static int
-deletejob(JobP jobs, pid_t pid) 
+static char *
+readcmd(size_t *lenp)
 {
-	int i;
+	static bool eof = false;
+	static size_t held = 0; /* end of the line returned last time */
+	static char saved;      /* the byte that its NUL terminator hid */
+	struct pollfd pfd[2];
+	char *line, *newline;
+	ssize_t nread;
 
-	if (pid < 1)
-		return (0);
-	for (i = 0; i < MAXJOBS; i++) {
-		if (jobs[i].pid == pid) {
-			clearjob(&jobs[i]);
-			nextjid = maxjid(jobs) + 1;
-			return (1);
+	if (held > 0) {
+		inbuf[held] = saved;
+		held = 0;
+	}
+	while (true) {
+		newline = memchr(&inbuf[inpos], '\n', inlen - inpos);
+		if (newline == NULL && eof && inlen > inpos)
+			newline = &inbuf[inlen++];  /* Room is kept for this. */
+		if (newline != NULL) {
+			*newline = '\n';
+			line = &inbuf[inpos];
+			*lenp = newline + 1 - line;
+			inpos += *lenp;
+			held = inpos;
+			saved = inbuf[held];
+			inbuf[held] = '\0';
+			return (line);
+		}
+		if (eof)
+			return (NULL);
+
+		/* Make room for more input, keeping two bytes spare. */
+		if (inpos > 0) {
+			memmove(inbuf, &inbuf[inpos], inlen - inpos);
+			inlen -= inpos;
+			inpos = 0;
+		}
+		if (insize - inlen < MAXLINE / 2) {
+			insize = insize > 0 ? 2 * insize : MAXLINE;
+			if ((inbuf = realloc(inbuf, insize)) == NULL)
+				unix_error("readcmd: realloc error");
+		}
+
+		/* Wait for input or a signal, handling signals first.
+		 * Output only needs to be flushed before the shell blocks.
+		 */
+		fflush(stdout);
+		traceflush();
+		pfd[0].fd = sigfd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = infd;
+		pfd[1].events = POLLIN;
+		if (poll(pfd, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			unix_error("poll error");
+		}
+		if (pfd[0].revents & POLLIN)
+			dispatch_signals(false);
+		if (pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+			nread = read(infd, &inbuf[inlen],
+			    insize - inlen - 2);
+			if (nread == 0)
+				eof = true;
+			else if (nread > 0)
+				inlen += nread;
+			else if (errno != EINTR && errno != EAGAIN)
+				app_error("read error");
 		}
 	}
-	return (0);
 }
 
 /*
- * fgpid
- * 
+ * runscript
+ *
  * Requires:
- *  "jobs" points to an array of MAXJOBS job structures.
+ *  "file" is a properly terminated string.
  *
  * Effects:
- *  Returns the PID of the current foreground job or 0 if no foreground
- *  job exists.
+ *  Evaluates each line of "file".  A regular file is mapped into memory
+ *  and each line is passed to eval where it lies in the mapping; other
+ *  files are read in large chunks.  Only a last line without a newline
+ *  is copied.  Returns false after printing an error if "file" cannot be
+ *  read.
  */
-static pid_t
-fgpid(JobP jobs)
+static bool
+runscript(const char *file)
 {
-	int i;
+	struct stat sb;
+	char *data, *line, *newline;
+	size_t size, len, pos;
+	ssize_t nread;
+	bool mapped;
+	int fd;
 
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].state == FG)
-			return (jobs[i].pid);
-	return (0);
+	if ((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1 ||
+	    fstat(fd, &sb) == -1) {
+		printf("%s: %s\n", file, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return (false);
+	}
+	size = sb.st_size;
+	mapped = S_ISREG(sb.st_mode) && size > 0 && (data = mmap(NULL, size,
+	    PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED;
+	if (mapped)
+		madvise(data, size, MADV_SEQUENTIAL);
+	else {
+		/* Read a pipe or device until end of file. */
+		data = NULL;
+		len = size = 0;
+		do {
+			if (size - len < ARENACHUNK) {
+				size = size > 0 ? 2 * size : 16 * ARENACHUNK;
+				if ((data = realloc(data, size)) == NULL)
+					unix_error("runscript: realloc error");
+			}
+			if ((nread = read(fd, &data[len], size - len)) > 0)
+				len += nread;
+		} while (nread > 0 || (nread == -1 && errno == EINTR));
+		size = len;
+	}
+	close(fd);
+
+	for (pos = 0; pos < size; pos += len) {
+		if ((newline = memchr(&data[pos], '\n', size - pos)) != NULL) {
+			len = newline + 1 - &data[pos];
+			eval(&data[pos], len);
+		} else {
+			len = size - pos;
+			if ((line = malloc(len + 1)) == NULL)
+				unix_error("runscript: malloc error");
+			memcpy(line, &data[pos], len);
+			line[len] = '\n';
+			eval(line, len + 1);
+			free(line);
+		}
+
+		/* Reap background jobs as the script runs. */
+		if (jobs.njobs > 0)
+			dispatch_signals(false);
+	}
+
+	if (mapped)
+		munmap(data, size);
+	else
+		free(data);
+	return (true);
 }
 
 /*
- * getjobpid
- * 
+ * endinput
+ *
  * Requires:
- *  "jobs" points to an array of MAXJOBS job structures.
+ *  Nothing.
  *
  * Effects:
- *  Returns a pointer to the job structure with process ID "pid" or NULL if
- *  no such job exists.
+ *  Exits the shell at the end of its input.  A batch first waits for
+ *  its jobs and exits with status 1 if any command failed.
  */
-static JobP
-getjobpid(JobP jobs, pid_t pid)
+static void
+endinput(void)
 {
-	int i;
 
-	if (pid < 1)
-		return (NULL);
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].pid == pid)
-			return (&jobs[i]);
-	return (NULL);
+	while (batch && jobs.njobs > 0)
+		dispatch_signals(true);
+	fflush(stdout);
+	exit(batch && nfailed > 0);
 }
 
 /*
- * getjobjid 
- * 
+ * signame
+ *
  * Requires:
- *  "jobs" points to an array of MAXJOBS job structures.
+ *  "buf" has room for SIG2STR_MAX + 3 characters.
  *
  * Effects:
- *  Returns a pointer to the job structure with job ID "jid" or NULL if no
- *  such job exists.
+ *  Writes the name of signal "signum", such as "SIGINT", to "buf" and
+ *  returns "buf".  A signal without a name is written as its number.
  */
-static JobP
-getjobjid(JobP jobs, int jid) 
+static char *
+signame(int signum, char *buf)
 {
-	int i;
 
-	if (jid < 1)
-		return (NULL);
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].jid == jid)
-			return (&jobs[i]);
-	return (NULL);
+	strcpy(buf, "SIG");
+	if (sig2str(signum, &buf[3]) == -1)
+		sprintf(buf, "%d", signum);
+	return (buf);
 }
 
 /*
- * pid2jid 
- * 
+ * arena_alloc
+ *
  * Requires:
- *  Nothing.
+ *  "arena" points to an arena.
  *
  * Effects:
- *  Returns the job ID for the job with process ID "pid" or 0 if no such
- *  job exists.
+ *  Returns "size" bytes from the arena, aligned for any pointer.  A new
+ *  chunk, at least twice the size of the last, is taken only when the
+ *  top chunk is full, so a steady stream of commands stops allocating.
  */
-static int
-pid2jid(pid_t pid) 
+static void *
+arena_alloc(struct Arena *arena, size_t size)
 {
-	int i;
+	struct ArenaChunk *chunk = arena->top;
+	size_t want;
+	void *ptr;
 
-	if (pid < 1)
-		return (0);
-	for (i = 0; i < MAXJOBS; i++)
-		if (jobs[i].pid == pid)
-			return (jobs[i].jid);
-	return (0);
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		want = chunk != NULL ? 2 * chunk->size : ARENACHUNK;
+		if (want < size)
+			want = size;
+		if (arena->spare != NULL && arena->spare->size >= want) {
+			chunk = arena->spare;
+			arena->spare = NULL;
+		} else if ((chunk = malloc(sizeof(struct ArenaChunk) + want)) ==
+		    NULL)
+			unix_error("arena_alloc: malloc error");
+		else
+			chunk->size = want;
+		chunk->used = 0;
+		chunk->prev = arena->top;
+		arena->top = chunk;
+	}
+	ptr = &chunk->data[chunk->used];
+	chunk->used += size;
+	return (ptr);
 }
 
 /*
- * listjobs
+ * arena_mark
  *
  * Requires:
- *  "jobs" points to an array of MAXJOBS job structures.
+ *  "arena" points to an arena.
  *
  * Effects:
- *  Prints the jobs list.
+ *  Returns a mark that arena_release can later return the arena to.
  */
-static void
-listjobs(JobP jobs) 
+static struct ArenaMark
+arena_mark(struct Arena *arena)
 {
-	int i;
+	struct ArenaMark mark;
 
-	for (i = 0; i < MAXJOBS; i++) {
-		if (jobs[i].pid != 0) {
-			printf("[%d] (%d) ", jobs[i].jid, (int)jobs[i].pid);
-			switch (jobs[i].state) {
-			case BG: 
-				printf("Running ");
-				break;
-			case FG: 
-				printf("Foreground ");
-				break;
-			case ST: 
-				printf("Stopped ");
-				break;
-			default:
-				printf("listjobs: Internal error: "
-				    "job[%d].state=%d ", i, jobs[i].state);
-			}
-			printf("%s", jobs[i].cmdline);
-		}
-	}
+	mark.chunk = arena->top;
+	mark.used = arena->top != NULL ? arena->top->used : 0;
+	return (mark);
 }
 
 /*
- * This comment marks the end of the jobs list helper routines.
+ * arena_release
+ *
+ * Requires:
+ *  "mark" was returned by arena_mark for "arena", and the arena has not
+ *  been released past it since.
+ *
+ * Effects:
+ *  Frees everything allocated from the arena since "mark" was taken,
+ *  keeping the largest freed chunk for reuse.
  */
+static void
+arena_release(struct Arena *arena, struct ArenaMark mark)
+{
+	struct ArenaChunk *chunk;
 
-/*
- * Other helper routines follow.
- */
+	while ((chunk = arena->top) != mark.chunk) {
+		arena->top = chunk->prev;
+		if (arena->spare == NULL || arena->spare->size < chunk->size) {
+			free(arena->spare);
+			arena->spare = chunk;
+		} else
+			free(chunk);
+	}
+	if (chunk != NULL)
+		chunk->used = mark.used;
+}
 
 /*
  * usage
@@ -921,10 +5279,25 @@ static void
 usage(void) 
 {
 
-	printf("Usage: shell [-hvp]\n");
+	printf("Usage: shell [-hvpik] [-e engine] [-j jobs] [-T trace] "
+	    "[-f script | script]\n");
 	printf("   -h   print this message\n");
 	printf("   -v   print additional diagnostic information\n");
 	printf("   -p   do not emit a command prompt\n");
+	printf("   -e   launch commands with \"fork\" (default), "
+	    "\"spawn\" or \"zygote\"\n");
+	printf("   -i   run echo, true, false, printf and sleep without "
+	    "exec\n");
+	printf("   -j   run at most this many jobs at once, queueing the "
+	    "rest;\n");
+	printf("        a foreground command waits for a free slot, and "
+	    "ctrl-c or\n");
+	printf("        ctrl-z cancels it while it waits\n");
+	printf("   -f   run each line of a script (- for stdin) as a "
+	    "background job\n");
+	printf("   -k   with -f, print each command's output in script "
+	    "order\n");
+	printf("   -T   record timestamped job events in a trace file\n");
 	exit(1);
 }
 
@@ -962,31 +5335,6 @@ app_error(const char *msg)
 	exit(1);
 }
 
-/*
- * Signal
- *
- * Requires:
- *  "signum" is a valid signal number, and "handler" is a valid signal
- *  handler.
- *
- * Effects:
- *  Registers a new handler for the specified signal, returning the old
- *  handler.  Behaves similarly to "sigset" but restarts system calls
- *  when possible.
- */
-static handler_t *
-Signal(int signum, handler_t *handler) 
-{
-	struct sigaction action, old_action;
-
-	action.sa_handler = handler;  
-	sigemptyset(&action.sa_mask); /* Block sigs of type being handled. */
-	action.sa_flags = SA_RESTART; /* Restart syscalls if possible. */
-	if (sigaction(signum, &action, &old_action) < 0)
-		unix_error("Signal error");
-	return (old_action.sa_handler);
-}
-
 /*
  * The last lines of this file configure the behavior of the "Tab" key in
  * emacs.  Emacs has a rudimentary understanding of C syntax and style.  In
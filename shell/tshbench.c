@@ -0,0 +1,554 @@
+/*
+ * tshbench - Microbenchmarks for the internals of tsh
+ *
+ * usage: tshbench [-n lines] [-b benchmark] [corpus]
+ *
+ * tsh.c is included directly so that its static routines can be timed
+ * without changing how the shell itself is built.  The benchmarks are:
+ *
+ *   parse    parseline over a corpus of command lines, either read from
+ *            the given file or generated
+ *   jobs     addjob, deletejob, getjobpid, getjobjid and fgpid
+ *   builtin  findbuiltin and builtin_cmd
+ *   signal   sig2str and str2sig
+ *   launch   launch and reap /bin/true with each engine, the zygote
+ *            having been started before the heap grew
+ *
+ * Without -b all of them run.  Each one is repeated PASSES times and the
+ * fastest pass is reported, in nanoseconds and heap allocations per
+ * operation.  Allocations are counted by wrapping malloc, calloc and
+ * realloc.
+ */
+
+#define main tsh_main
+#include "tsh.c"
+#undef main
+
+#define PASSES 5    /* passes over each benchmark; the fastest is reported */
+#define NJOBS  1000 /* jobs in the list while jobs are looked up */
+
+struct Corpus {             /* Command lines to parse */
+	char **lines;           /* the lines, each ending in '\n' */
+	size_t *lens;           /* the length of each line */
+	size_t nlines;          /* number of lines */
+	size_t nbytes;          /* total length of the lines */
+};
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+size_t nallocs = 0;         /* number of heap allocations so far */
+size_t sink = 0;            /* results that must not be optimized away */
+
+static void gencorpus(struct Corpus *corpus, size_t nlines);
+static void readcorpus(struct Corpus *corpus, const char *file);
+static void addline(struct Corpus *corpus, const char *line, size_t len);
+static void bench_parse(struct Corpus *corpus);
+static void timeit(const char *name, void (*fn)(size_t), size_t n);
+static void op_addjob(size_t n);
+static void op_getjobpid(size_t n);
+static void op_getjobjid(size_t n);
+static void op_fgpid(size_t n);
+static void op_findbuiltin(size_t n);
+static void op_builtin_cmd(size_t n);
+static void op_sig2str(size_t n);
+static void op_str2sig(size_t n);
+static void op_launch(size_t n);
+static double now(void);
+
+int
+main(int argc, char **argv)
+{
+	struct Corpus corpus = { NULL, NULL, 0, 0 };
+	const char *which = NULL;
+	size_t i, nlines = 1000000;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:b:")) != -1) {
+		switch (c) {
+		case 'n':
+			nlines = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			which = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: tshbench [-n lines] "
+			    "[-b parse|jobs|builtin|signal|launch] [corpus]\n");
+			exit(1);
+		}
+	}
+
+	/* Set the shell up as its main routine does. */
+	sigemptyset(&shell_sigs);
+	sigaddset(&shell_sigs, SIGINT);
+	sigaddset(&shell_sigs, SIGTSTP);
+	sigaddset(&shell_sigs, SIGCHLD);
+	sigaddset(&shell_sigs, SIGQUIT);
+	if (sigprocmask(SIG_BLOCK, &shell_sigs, NULL) == -1)
+		unix_error("sigprocmask error");
+	if ((sigfd = signalfd(-1, &shell_sigs, SFD_NONBLOCK | SFD_CLOEXEC)) ==
+	    -1)
+		unix_error("signalfd error");
+	engine = ZYGOTE;
+	initlaunch();
+	initenv();
+	initpath(getenv("PATH"));
+	initjobs(&jobs);
+
+	if (which == NULL || strcmp(which, "parse") == 0) {
+		if (optind < argc)
+			readcorpus(&corpus, argv[optind]);
+		else
+			gencorpus(&corpus, nlines);
+		bench_parse(&corpus);
+	}
+	if (which == NULL || strcmp(which, "jobs") == 0) {
+		timeit("addjob+deletejob", op_addjob, 1000000);
+		for (i = 1; i <= NJOBS; i++)
+			addjob(&jobs, i, i == NJOBS ? FG : BG, "./myspin 1 &\n",
+			    13);
+		timeit("getjobpid", op_getjobpid, 10000000);
+		timeit("getjobjid", op_getjobjid, 10000000);
+		timeit("fgpid", op_fgpid, 10000000);
+		for (i = 1; i <= NJOBS; i++)
+			deletejob(&jobs, i);
+	}
+	if (which == NULL || strcmp(which, "builtin") == 0) {
+		timeit("findbuiltin", op_findbuiltin, 10000000);
+		timeit("builtin_cmd", op_builtin_cmd, 10000000);
+	}
+	if (which == NULL || strcmp(which, "signal") == 0) {
+		timeit("sig2str", op_sig2str, 10000000);
+		timeit("str2sig", op_str2sig, 10000000);
+	}
+	if (which == NULL || strcmp(which, "launch") == 0) {
+		engine = FORK;
+		timeit("launch fork /bin/true", op_launch, 200);
+		engine = SPAWN;
+		timeit("launch spawn /bin/true", op_launch, 200);
+		engine = ZYGOTE;
+		timeit("launch zygote /bin/true", op_launch, 200);
+	}
+	exit(sink == 0);
+}
+
+/*
+ * malloc, calloc and realloc
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Count each allocation in "nallocs" and pass it on to the C library.
+ */
+void *
+malloc(size_t size)
+{
+
+	nallocs++;
+	return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+
+	nallocs++;
+	return (__libc_calloc(nmemb, size));
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+
+	nallocs++;
+	return (__libc_realloc(ptr, size));
+}
+
+/*
+ * gencorpus
+ *
+ * Requires:
+ *  "corpus" is empty.
+ *
+ * Effects:
+ *  Fills "corpus" with "nlines" pseudo-random command lines that look like
+ *  the ones in the trace files: a program, zero to a dozen arguments of
+ *  varying length, some quoted, and sometimes a trailing "&".  The same
+ *  lines are generated on every run.
+ */
+static void
+gencorpus(struct Corpus *corpus, size_t nlines)
+{
+	static const char *progs[] = { "/bin/echo", "./myspin", "./mysplit",
+	    "ls", "/bin/ps", "fg", "jobs", "make" };
+	static const char *words[] = { "tsh>", "1", "%2", "-l", "gx",
+	    "/usr/local/include/sys", "hello", "world", "--verbose",
+	    "a_rather_long_argument_with_no_spaces_in_it", "x" };
+	unsigned long seed = 12345;
+	char line[4096];
+	size_t i, len;
+	int j, nargs;
+
+	for (i = 0; i < nlines; i++) {
+		seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+		len = sprintf(line, "%s", progs[(seed >> 33) % 8]);
+		nargs = (seed >> 40) % 13;
+		for (j = 0; j < nargs; j++) {
+			seed = seed * 6364136223846793005UL +
+			    1442695040888963407UL;
+			if ((seed >> 60) == 0)
+				len += sprintf(&line[len], " '%s %s'",
+				    words[(seed >> 33) % 11],
+				    words[(seed >> 45) % 11]);
+			else
+				len += sprintf(&line[len], " %s",
+				    words[(seed >> 33) % 11]);
+		}
+		if ((seed >> 56) % 4 == 0)
+			len += sprintf(&line[len], " &");
+		line[len++] = '\n';
+		addline(corpus, line, len);
+	}
+}
+
+/*
+ * readcorpus
+ *
+ * Requires:
+ *  "corpus" is empty.
+ *
+ * Effects:
+ *  Fills "corpus" with the lines of "file", giving the last line a
+ *  newline if it has none.
+ */
+static void
+readcorpus(struct Corpus *corpus, const char *file)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		unix_error(file);
+	while ((len = getline(&line, &size, fp)) != -1) {
+		if (line[len - 1] != '\n') {
+			if ((size_t)len + 1 >= size &&
+			    (line = realloc(line, size = len + 2)) == NULL)
+				unix_error("readcorpus: realloc error");
+			line[len++] = '\n';
+			line[len] = '\0';
+		}
+		addline(corpus, line, len);
+	}
+	free(line);
+	fclose(fp);
+}
+
+/*
+ * addline
+ *
+ * Requires:
+ *  "line" holds "len" bytes.
+ *
+ * Effects:
+ *  Appends a NUL terminated copy of "line" to "corpus".
+ */
+static void
+addline(struct Corpus *corpus, const char *line, size_t len)
+{
+	size_t n = corpus->nlines;
+
+	/* Grow the arrays whenever their size reaches a power of two. */
+	if ((n & (n - 1)) == 0) {
+		if ((corpus->lines = realloc(corpus->lines,
+		    (n > 0 ? 2 * n : 1) * sizeof(char *))) == NULL ||
+		    (corpus->lens = realloc(corpus->lens,
+		    (n > 0 ? 2 * n : 1) * sizeof(size_t))) == NULL)
+			unix_error("addline: realloc error");
+	}
+	if ((corpus->lines[n] = malloc(len + 1)) == NULL)
+		unix_error("addline: malloc error");
+	memcpy(corpus->lines[n], line, len);
+	corpus->lines[n][len] = '\0';
+	corpus->lens[n] = len;
+	corpus->nlines++;
+	corpus->nbytes += len;
+}
+
+/*
+ * bench_parse
+ *
+ * Requires:
+ *  "corpus" is not empty.
+ *
+ * Effects:
+ *  Parses every line of "corpus" PASSES times, releasing the arena after
+ *  each line as eval does, and prints the throughput of the fastest pass.
+ */
+static void
+bench_parse(struct Corpus *corpus)
+{
+	struct Arena arena = { NULL, NULL };
+	struct ArenaMark mark;
+	char **argv;
+	double start, best = 0;
+	size_t i, nargs = 0, allocs = 0;
+	int pass;
+
+	for (pass = 0; pass < PASSES; pass++) {
+		allocs = nallocs;
+		start = now();
+		for (i = 0; i < corpus->nlines; i++) {
+			mark = arena_mark(&arena);
+			parseline(corpus->lines[i], corpus->lens[i], &arena,
+			    &argv);
+			nargs += argv[0] != NULL;
+			arena_release(&arena, mark);
+		}
+		start = now() - start;
+		allocs = nallocs - allocs;
+		if (pass == 0 || start < best)
+			best = start;
+	}
+	printf("parseline: %zu lines, %zu bytes: %.1f ns/line, %.0f MB/s "
+	    "(%zu commands)\n", corpus->nlines, corpus->nbytes,
+	    best * 1e9 / corpus->nlines, corpus->nbytes / best / 1e6,
+	    nargs / PASSES);
+	printf("%-24s %10.1f ns/op %8.2f allocs/op\n", "parseline",
+	    best * 1e9 / corpus->nlines, (double)allocs / corpus->nlines);
+	sink += nargs;
+}
+
+/*
+ * timeit
+ *
+ * Requires:
+ *  "fn" performs "n" operations of the benchmark "name".
+ *
+ * Effects:
+ *  Calls "fn" once to warm up and then PASSES times, and prints the time
+ *  and the number of allocations per operation of the fastest pass.
+ */
+static void
+timeit(const char *name, void (*fn)(size_t), size_t n)
+{
+	double start, best = 0;
+	size_t allocs, bestallocs = 0;
+	int pass;
+
+	fn(n / 10 + 1);
+	for (pass = 0; pass < PASSES; pass++) {
+		allocs = nallocs;
+		start = now();
+		fn(n);
+		start = now() - start;
+		allocs = nallocs - allocs;
+		if (pass == 0 || start < best) {
+			best = start;
+			bestallocs = allocs;
+		}
+	}
+	printf("%-24s %10.1f ns/op %8.2f allocs/op\n", name, best * 1e9 / n,
+	    (double)bestallocs / n);
+	fflush(stdout);
+}
+
+/*
+ * op_addjob
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Adds a background job and deletes it again "n" times.
+ */
+static void
+op_addjob(size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		addjob(&jobs, 100000 + (i & 1023), BG, "./myspin 1 &\n", 13);
+		sink += deletejob(&jobs, 100000 + (i & 1023));
+	}
+}
+
+/*
+ * op_getjobpid
+ *
+ * Requires:
+ *  The jobs list holds jobs with PIDs 1 to NJOBS.
+ *
+ * Effects:
+ *  Looks a job up by PID "n" times.
+ */
+static void
+op_getjobpid(size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sink += getjobpid(&jobs, 1 + i % NJOBS)->jid;
+}
+
+/*
+ * op_getjobjid
+ *
+ * Requires:
+ *  The jobs list holds jobs with job IDs 1 to NJOBS.
+ *
+ * Effects:
+ *  Looks a job up by job ID "n" times.
+ */
+static void
+op_getjobjid(size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sink += getjobjid(&jobs, 1 + i % NJOBS)->pid;
+}
+
+/*
+ * op_fgpid
+ *
+ * Requires:
+ *  The jobs list has a foreground job.
+ *
+ * Effects:
+ *  Finds the foreground job "n" times.
+ */
+static void
+op_fgpid(size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sink += fgpid(&jobs);
+}
+
+/*
+ * op_findbuiltin
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Looks up "n" command names, half of them builtins and half not.
+ */
+static void
+op_findbuiltin(size_t n)
+{
+	static const char *names[] = { "jobs", "fg", "kill", "bench",
+	    "./myspin", "ls", "/bin/echo", "make" };
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sink += findbuiltin(names[i & 7]) != NULL;
+}
+
+/*
+ * op_builtin_cmd
+ *
+ * Requires:
+ *  The jobs list is empty.
+ *
+ * Effects:
+ *  Dispatches the jobs builtin, which then has nothing to print, "n"
+ *  times.
+ */
+static void
+op_builtin_cmd(size_t n)
+{
+	char *argv[] = { "jobs", NULL };
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sink += builtin_cmd(argv);
+}
+
+/*
+ * op_sig2str
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Names "n" signals, cycling through signals 1 to 64.
+ */
+static void
+op_sig2str(size_t n)
+{
+	char name[SIG2STR_MAX];
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sink += sig2str(1 + (i & 63), name) == 0;
+}
+
+/*
+ * op_str2sig
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Parses "n" signal names and numbers.
+ */
+static void
+op_str2sig(size_t n)
+{
+	static const char *names[] = { "INT", "TSTP", "CHLD", "KILL",
+	    "RTMIN+3", "RTMAX-1", "9", "BOGUS" };
+	size_t i;
+	int sig;
+
+	for (i = 0; i < n; i++)
+		sink += str2sig(names[i & 7], &sig) == 0;
+}
+
+/*
+ * op_launch
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Launches /bin/true with the selected engine and reaps it "n" times.
+ */
+static void
+op_launch(size_t n)
+{
+	char *argv[] = { "/bin/true", NULL };
+	size_t i;
+	pid_t pid;
+
+	for (i = 0; i < n; i++) {
+		if ((pid = launch(argv[0], argv)) == 0 ||
+		    waitpid(pid, NULL, 0) != pid)
+			unix_error("op_launch: launch error");
+		sink++;
+	}
+}
+
+/*
+ * now
+ *
+ * Requires:
+ *  Nothing.
+ *
+ * Effects:
+ *  Returns the time in seconds on the monotonic clock.
+ */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}